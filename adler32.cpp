@@ -0,0 +1,180 @@
+/* Adler-32 calculation for zlib format
+ *
+ *  1. the modulo is delayed up to NMAX bytes, where the sums fit 32 bits.
+ *  2. a vector kernel takes large buffers when the CPU has it and it
+ *     passes the self-test against the bytewise reference at the start.
+ *
+ * References:
+ *
+ *  P. Deutsch and J-L. Gailly, ``RFC 1950 ZLIB Compressed Data Format
+ *     Specification version 3.3'', 1996, 9. Appendix: Sample code
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+void digest_adler32::clear ()
+{
+    adler = 1;
+}
+
+std::uint32_t digest_adler32::digest ()
+{
+    return adler;
+}
+
+void digest_adler32::update (std::uint8_t const* p, std::size_t n)
+{
+    adler = checksum (adler, p, n);
+}
+
+static std::uint32_t adler32_scalar (std::uint32_t adler,
+    std::uint8_t const* p, std::size_t n)
+{
+    std::uint32_t s1 = adler & 0xffff;
+    std::uint32_t s2 = adler >> 16;
+    while (n > 0) {
+        std::size_t m = std::min (n, static_cast<std::size_t> (ADLER32_NMAX));
+        n -= m;
+        for (; m >= 8; m -= 8, p += 8) {
+            s2 += (s1 += p[0]);
+            s2 += (s1 += p[1]);
+            s2 += (s1 += p[2]);
+            s2 += (s1 += p[3]);
+            s2 += (s1 += p[4]);
+            s2 += (s1 += p[5]);
+            s2 += (s1 += p[6]);
+            s2 += (s1 += p[7]);
+        }
+        for (; m > 0; --m, ++p)
+            s2 += (s1 += *p);
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+    return (s2 << 16) | s1;
+}
+
+static std::uint32_t adler32_combined (adler32_kernel vector,
+    std::uint32_t adler, std::uint8_t const* p, std::size_t n)
+{
+    if (vector != nullptr && n >= 32) {
+        std::size_t const m = n & ~static_cast<std::size_t> (31);
+        adler = vector (adler, p, m);
+        p += m;
+        n -= m;
+    }
+    return adler32_scalar (adler, p, n);
+}
+
+/* 9. Appendix: Sample code */
+static std::uint32_t adler32_reference (std::uint32_t adler,
+    std::uint8_t const* p, std::size_t n)
+{
+    std::uint32_t s1 = adler & 0xffff;
+    std::uint32_t s2 = adler >> 16;
+    for (std::size_t i = 0; i < n; ++i) {
+        s1 = (s1 + p[i]) % ADLER32_BASE;
+        s2 = (s2 + s1) % ADLER32_BASE;
+    }
+    return (s2 << 16) | s1;
+}
+
+static bool adler32_selftest (adler32_kernel vector)
+{
+    /* longer than NMAX to check the delayed modulo, and all 0xff tail
+     * to check the worst case of the sums.
+     */
+    std::vector<std::uint8_t> data (3 * ADLER32_NMAX + 64, 0xff);
+    std::uint32_t x = 0x12345678L;
+    for (std::size_t i = 0; i < data.size () / 2; ++i) {
+        x = x * 1103515245L + 12345L;
+        data[i] = x >> 24;
+    }
+    std::size_t const sizes[] = {
+        0, 1, 31, 32, 33, 63, 64, 100, 1000,
+        ADLER32_NMAX - 1, ADLER32_NMAX, ADLER32_NMAX + 1, 3 * ADLER32_NMAX};
+    std::uint32_t const seeds[] = {1, 0xfff0fff0L, 0x0001fff0L};
+    for (std::size_t n : sizes)
+        for (std::size_t offset = 0; offset < 64; offset += 21)
+            for (std::uint32_t adler : seeds) {
+                std::uint8_t const* p = &data[offset];
+                if (adler32_combined (vector, adler, p, n)
+                        != adler32_reference (adler, p, n))
+                    return false;
+                p = &data[data.size () - n];
+                if (adler32_combined (vector, adler, p, n)
+                        != adler32_reference (adler, p, n))
+                    return false;
+            }
+    return true;
+}
+
+struct adler32_dispatch {
+    adler32_kernel vector;
+    char const* name;
+    adler32_dispatch ();
+};
+
+adler32_dispatch::adler32_dispatch () : vector (nullptr), name ("scalar")
+{
+    if (! adler32_selftest (nullptr))
+        throw std::logic_error ("digest_adler32: scalar self-test failed.");
+    char const* vector_name = nullptr;
+    adler32_kernel candidate = adler32_vector_kernel (vector_name);
+    if (candidate != nullptr && adler32_selftest (candidate)) {
+        vector = candidate;
+        name = vector_name;
+    }
+}
+
+static adler32_dispatch const& shared_adler32_dispatch ()
+{
+    static adler32_dispatch const dispatch;
+    return dispatch;
+}
+
+std::uint32_t digest_adler32::checksum (std::uint32_t adler,
+    std::uint8_t const* p, std::size_t n)
+{
+    return adler32_combined (shared_adler32_dispatch ().vector, adler, p, n);
+}
+
+char const* digest_adler32::kernel_name ()
+{
+    return shared_adler32_dispatch ().name;
+}
+
+}// namespace deflate
@@ -0,0 +1,166 @@
+/* Adler-32 vector kernels
+ *
+ *  1. s1 sums bytes with PSADBW, s2 sums bytes weighted with 32 .. 1
+ *     by PMADDUBSW and PMADDWD for a 32 bytes block.
+ *  2. s2 takes 32 times the s1 before each block, accumulated as
+ *     the prefix sums in a vector, at the end of the run.
+ *  3. the modulo is delayed up to NMAX / 32 blocks.
+ *  4. they take 32 or multiple of 32 bytes.
+ *
+ * References:
+ *
+ *  P. Deutsch and J-L. Gailly, ``RFC 1950 ZLIB Compressed Data Format
+ *     Specification version 3.3'', 1996, 9. Appendix: Sample code
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "deflate.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DEFLATE_ADLER32_X86 1
+#endif
+
+namespace deflate {
+
+#if defined(DEFLATE_ADLER32_X86)
+
+__attribute__ ((target ("ssse3")))
+static std::uint32_t adler32_ssse3 (std::uint32_t adler,
+    std::uint8_t const* p, std::size_t n)
+{
+    std::uint32_t s1 = adler & 0xffff;
+    std::uint32_t s2 = adler >> 16;
+    std::size_t blocks = n / 32;
+    __m128i const tap1 = _mm_setr_epi8 (
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    __m128i const tap2 = _mm_setr_epi8 (
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i const zero = _mm_setzero_si128 ();
+    __m128i const ones = _mm_set1_epi16 (1);
+    while (blocks > 0) {
+        std::size_t m = std::min (blocks,
+            static_cast<std::size_t> (ADLER32_NMAX / 32));
+        blocks -= m;
+        __m128i v_ps = _mm_set_epi32 (0, 0, 0, s1 * m);
+        __m128i v_s2 = _mm_set_epi32 (0, 0, 0, s2);
+        __m128i v_s1 = zero;
+        for (; m > 0; --m, p += 32) {
+            __m128i const b1 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p));
+            __m128i const b2 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 16));
+            v_ps = _mm_add_epi32 (v_ps, v_s1);
+            v_s1 = _mm_add_epi32 (v_s1, _mm_sad_epu8 (b1, zero));
+            v_s2 = _mm_add_epi32 (v_s2,
+                _mm_madd_epi16 (_mm_maddubs_epi16 (b1, tap1), ones));
+            v_s1 = _mm_add_epi32 (v_s1, _mm_sad_epu8 (b2, zero));
+            v_s2 = _mm_add_epi32 (v_s2,
+                _mm_madd_epi16 (_mm_maddubs_epi16 (b2, tap2), ones));
+        }
+        v_s2 = _mm_add_epi32 (v_s2, _mm_slli_epi32 (v_ps, 5));
+        v_s1 = _mm_add_epi32 (v_s1, _mm_shuffle_epi32 (v_s1, _MM_SHUFFLE (1, 0, 3, 2)));
+        s1 += _mm_cvtsi128_si32 (v_s1);
+        v_s2 = _mm_add_epi32 (v_s2, _mm_shuffle_epi32 (v_s2, _MM_SHUFFLE (2, 3, 0, 1)));
+        v_s2 = _mm_add_epi32 (v_s2, _mm_shuffle_epi32 (v_s2, _MM_SHUFFLE (1, 0, 3, 2)));
+        s2 = _mm_cvtsi128_si32 (v_s2);
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+    return (s2 << 16) | s1;
+}
+
+__attribute__ ((target ("avx2")))
+static std::uint32_t adler32_avx2 (std::uint32_t adler,
+    std::uint8_t const* p, std::size_t n)
+{
+    std::uint32_t s1 = adler & 0xffff;
+    std::uint32_t s2 = adler >> 16;
+    std::size_t blocks = n / 32;
+    __m256i const tap = _mm256_setr_epi8 (
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    __m256i const zero = _mm256_setzero_si256 ();
+    __m256i const ones = _mm256_set1_epi16 (1);
+    while (blocks > 0) {
+        std::size_t m = std::min (blocks,
+            static_cast<std::size_t> (ADLER32_NMAX / 32));
+        blocks -= m;
+        __m256i v_ps = _mm256_setr_epi32 (s1 * m, 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s2 = _mm256_setr_epi32 (s2, 0, 0, 0, 0, 0, 0, 0);
+        __m256i v_s1 = zero;
+        for (; m > 0; --m, p += 32) {
+            __m256i const b = _mm256_loadu_si256 (reinterpret_cast<__m256i const*> (p));
+            v_ps = _mm256_add_epi32 (v_ps, v_s1);
+            v_s1 = _mm256_add_epi32 (v_s1, _mm256_sad_epu8 (b, zero));
+            v_s2 = _mm256_add_epi32 (v_s2,
+                _mm256_madd_epi16 (_mm256_maddubs_epi16 (b, tap), ones));
+        }
+        v_s2 = _mm256_add_epi32 (v_s2, _mm256_slli_epi32 (v_ps, 5));
+        /* horizontal sums of 8 lanes */
+        __m128i x1 = _mm_add_epi32 (_mm256_castsi256_si128 (v_s1),
+            _mm256_extracti128_si256 (v_s1, 1));
+        __m128i x2 = _mm_add_epi32 (_mm256_castsi256_si128 (v_s2),
+            _mm256_extracti128_si256 (v_s2, 1));
+        x1 = _mm_add_epi32 (x1, _mm_shuffle_epi32 (x1, _MM_SHUFFLE (1, 0, 3, 2)));
+        x2 = _mm_add_epi32 (x2, _mm_shuffle_epi32 (x2, _MM_SHUFFLE (2, 3, 0, 1)));
+        x2 = _mm_add_epi32 (x2, _mm_shuffle_epi32 (x2, _MM_SHUFFLE (1, 0, 3, 2)));
+        s1 += _mm_cvtsi128_si32 (x1);
+        s2 = _mm_cvtsi128_si32 (x2);
+        s1 %= ADLER32_BASE;
+        s2 %= ADLER32_BASE;
+    }
+    return (s2 << 16) | s1;
+}
+
+adler32_kernel adler32_vector_kernel (char const*& name)
+{
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2")) {
+        name = "avx2";
+        return adler32_avx2;
+    }
+    if (__builtin_cpu_supports ("ssse3")) {
+        name = "ssse3";
+        return adler32_ssse3;
+    }
+    return nullptr;
+}
+
+#else
+
+adler32_kernel adler32_vector_kernel (char const*& name)
+{
+    return nullptr;
+}
+
+#endif
+
+}// namespace deflate
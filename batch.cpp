@@ -0,0 +1,196 @@
+/* batch compression/decompression of many files
+ *
+ *  1. the files come from the arguments, a list file, and the trees
+ *     under the directories with -R.
+ *  2. they run on the work-stealing thread pool, the largest first,
+ *     so that a large file does not start at the tail of the batch.
+ *  3. a large gzip file is cut into chunks compressed in parallel, each
+ *     as a member of its own telling its size in the header, and the
+ *     last chunk done writes the file.
+ *  4. each worker reuses its streams from a file to the next.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <stdexcept>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "deflate.hpp"
+
+namespace deflate {
+
+struct batch_file {
+    std::string path;
+    std::size_t size;
+};
+
+/* the chunks of a large file in flight */
+struct split_job {
+    explicit split_job (std::string const& apath)
+        : path (apath), input (apath), parts (), left (0), failed (false) {}
+    std::string path;
+    mapped_file input;
+    std::vector<std::string> parts;
+    std::atomic<int> left;
+    std::atomic<bool> failed;
+};
+
+static bool has_suffix (std::string const& s, std::string const& suffix)
+{
+    return s.size () > suffix.size ()
+        && s.compare (s.size () - suffix.size (), suffix.size (), suffix) == 0;
+}
+
+/* take the path, or the regular files under it with recursive. in
+ * a tree, the compression skips the files with the suffix, and the
+ * decompression takes only them.
+ */
+void collect_files (std::string const& path, bool recursive,
+    bool decompress, int format, std::vector<std::string>& files)
+{
+    struct stat st;
+    DIR* dir = nullptr;
+    if (! recursive || ::stat (path.c_str (), &st) < 0 || ! S_ISDIR (st.st_mode)
+            || (dir = ::opendir (path.c_str ())) == nullptr) {
+        files.push_back (path);
+        return;
+    }
+    std::string const suffix = file_suffix (format);
+    while (struct dirent* e = ::readdir (dir)) {
+        std::string const name (e->d_name);
+        if (name == "." || name == "..")
+            continue;
+        std::string const sub = path + "/" + name;
+        if (::lstat (sub.c_str (), &st) < 0)
+            continue;
+        if (S_ISDIR (st.st_mode))
+            collect_files (sub, recursive, decompress, format, files);
+        else if (S_ISREG (st.st_mode) && has_suffix (name, suffix) == decompress)
+            files.push_back (sub);
+    }
+    ::closedir (dir);
+}
+
+/* report each failure, and return the number of the failed files. */
+int gzip_batch (std::vector<std::string> const& paths, bool decompress,
+    int format, int nthreads, std::ostream& report)
+{
+    std::vector<batch_file> files;
+    for (std::string const& path : paths) {
+        struct stat st;
+        std::size_t size = ::stat (path.c_str (), &st) == 0 ? st.st_size : 0;
+        files.push_back (batch_file {path, size});
+    }
+    std::stable_sort (files.begin (), files.end (),
+        [](batch_file const& a, batch_file const& b) { return a.size > b.size; });
+
+    std::mutex mutex;
+    int nfailed = 0;
+    auto fail = [&](std::string const& path, char const* message) {
+        std::lock_guard<std::mutex> lock (mutex);
+        ++nfailed;
+        report << path << ": FAILED " << message << std::endl;
+    };
+    /* a single file takes all the threads for BGZF */
+    int const inner = files.size () == 1 ? nthreads : 1;
+    thread_pool pool (nthreads);
+    for (batch_file const& f : files) {
+        std::string const path = f.path;
+        if (decompress || format != FORMAT_GZIP || nthreads < 2
+                || f.size < 2 * SPLITSIZE) {
+            pool.submit ([&, path]{
+                try {
+                    if (decompress)
+                        gunzip_file (path, format, inner);
+                    else
+                        gzip_file (path, format, inner);
+                }
+                catch (std::exception& e) {
+                    fail (path, e.what ());
+                }
+            });
+            continue;
+        }
+        std::shared_ptr<split_job> job;
+        try {
+            struct stat st;
+            if (::stat ((path + file_suffix (format)).c_str (), &st) == 0)
+                throw std::runtime_error ("cppgzip: " + path
+                    + file_suffix (format) + ": already exists.");
+            job = std::make_shared<split_job> (path);
+        }
+        catch (std::exception& e) {
+            fail (path, e.what ());
+            continue;
+        }
+        std::size_t const size = job->input.size ();
+        int const nparts = (size + SPLITSIZE - 1) / SPLITSIZE;
+        job->parts.resize (nparts);
+        job->left = nparts;
+        for (int k = 0; k < nparts; ++k)
+            pool.submit ([&fail, job, k, size]{
+                try {
+                    if (! job->failed) {
+                        std::size_t const off = static_cast<std::size_t> (k) * SPLITSIZE;
+                        std::string& out = job->parts[k];
+                        /* room for the header of the split member in
+                         * front of the bare one of the stream
+                         */
+                        out.assign (SPLIT_HEADERSIZE - 10, '\0');
+                        compress_span (FORMAT_GZIP, job->input.data () + off,
+                            std::min (size - off, static_cast<std::size_t> (SPLITSIZE)),
+                            [&out](std::uint8_t const* p, std::size_t n) {
+                                out.append (reinterpret_cast<char const*> (p), n);
+                            });
+                        put_split_header (reinterpret_cast<std::uint8_t*> (&out[0]),
+                            out.size ());
+                    }
+                }
+                catch (std::exception& e) {
+                    if (! job->failed.exchange (true))
+                        fail (job->path, e.what ());
+                }
+                if (--job->left > 0 || job->failed)
+                    return;
+                try {
+                    write_parts (job->path + file_suffix (FORMAT_GZIP), job->parts);
+                }
+                catch (std::exception& e) {
+                    fail (job->path, e.what ());
+                }
+            });
+    }
+    pool.wait ();
+    return nfailed;
+}
+
+}// namespace deflate
@@ -0,0 +1,604 @@
+/* reproducible benchmark of the compression and the decompression
+ *
+ *  1. the corpora are generated from a fixed seed: text, source code,
+ *     logs, random bytes, zeros, and a mix of them with binary records.
+ *  2. each case runs in a child process of its own, so that the peak
+ *     RSS is that of the case: the corpus, the buffers and the streams.
+ *  3. the speed is the best of the repeats in MB/s of the input, and
+ *     the allocations are counted by operator new in the last repeat.
+ *     a case stops repeating after a few seconds, as the compression
+ *     of the long runs of the same bytes is slow.
+ *  4. the strategies are the flush modes of deflate_stream every
+ *     64 KiB, and the levels are the compressor profiles. more than one
+ *     thread compresses gzip members in parallel over the thread pool,
+ *     a member for each thread, or for each 1 MiB of a larger corpus.
+ *  5. the results go to stdout as JSON.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "deflate.hpp"
+
+static std::atomic<long> allocations (0);
+static std::atomic<long> allocated_bytes (0);
+
+void* operator new (std::size_t n)
+{
+    ++allocations;
+    allocated_bytes += n;
+    void* p = std::malloc (n == 0 ? 1 : n);
+    if (p == nullptr)
+        throw std::bad_alloc ();
+    return p;
+}
+
+void operator delete (void* p) noexcept
+{
+    std::free (p);
+}
+
+void operator delete (void* p, std::size_t) noexcept
+{
+    std::free (p);
+}
+
+namespace deflate {
+
+enum {
+    FLUSHSIZE = 64 * 1024,
+    PARTSIZE = 1024 * 1024
+};
+
+/* xorshift64*: the same sequence on every host */
+class bench_random {
+public:
+    explicit bench_random (std::uint64_t seed) : s (seed) {}
+    std::uint64_t next ()
+    {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545f4914f6cdd1dULL;
+    }
+    /* a skewed pick in 0 .. n-1: the small ones are the frequent ones */
+    std::size_t skewed (std::size_t n) { return next () % (next () % n + 1); }
+private:
+    std::uint64_t s;
+};
+
+static char const* const words[] = {
+    "the", "of", "and", "to", "a", "in", "is", "that", "for", "it", "as",
+    "was", "with", "be", "by", "on", "not", "he", "this", "are", "or",
+    "his", "from", "at", "which", "but", "have", "an", "had", "they",
+    "you", "were", "their", "one", "all", "we", "can", "her", "has",
+    "there", "been", "if", "more", "when", "will", "would", "who", "so",
+    "no", "block", "stream", "window", "string", "length", "distance",
+    "symbol", "table", "buffer", "compression", "huffman", "literal",
+    "history", "member", "header", "trailer", "checksum", "thread",
+    "queue", "record", "value", "server", "request", "response", "user",
+    "memory", "system", "number", "between", "without", "because",
+    "through", "another", "general", "different", "following", "example"
+};
+enum {NWORDS = sizeof (words) / sizeof (words[0])};
+
+static std::string word (bench_random& r)
+{
+    return words[r.skewed (NWORDS)];
+}
+
+static void make_text (bench_random& r, std::size_t n, std::string& out)
+{
+    while (out.size () < n) {
+        std::string s = word (r);
+        s[0] = std::toupper (s[0]);
+        for (int k = r.next () % 14 + 3; k > 0; --k)
+            s += (r.next () % 11 == 0 ? ", " : " ") + word (r);
+        out += s + (r.next () % 6 == 0 ? ".\n\n" : ". ");
+    }
+}
+
+static void make_source (bench_random& r, std::size_t n, std::string& out)
+{
+    static char const* const types[] = {"int", "std::size_t", "bool",
+        "std::uint32_t", "auto", "char const*"};
+    static char const* const ops[] = {" + ", " - ", " * ", " < ", " == ",
+        " >> ", " & "};
+    auto name = [](bench_random& r) {
+        return std::string (words[r.next () % NWORDS]);
+    };
+    int depth = 1;
+    while (out.size () < n) {
+        std::string line (depth * 4, ' ');
+        switch (depth > 5 ? 2 : r.next () % 6) {
+        case 0:
+            line += std::string ("for (") + types[r.skewed (6)] + " i = 0; i < "
+                + name (r) + "_size; ++i) {";
+            ++depth;
+            break;
+        case 1:
+            line += "if (" + name (r) + ops[r.skewed (7)]
+                + std::to_string (r.next () % 64) + ") {";
+            ++depth;
+            break;
+        case 2:
+            if (depth > 1) {
+                --depth;
+                line.assign (depth * 4, ' ');
+                line += "}";
+                break;
+            }
+            /* fall through */
+        case 3:
+            line += std::string (types[r.skewed (6)]) + " " + name (r) + "_"
+                + name (r) + " = " + name (r) + ops[r.skewed (7)]
+                + name (r) + ";";
+            break;
+        case 4:
+            line += name (r) + "_" + name (r) + " (" + name (r) + ", "
+                + std::to_string (r.next () % 4096) + ");";
+            break;
+        default:
+            line += "/* " + name (r) + " " + name (r) + " " + name (r) + " */";
+            break;
+        }
+        out += line + "\n";
+    }
+}
+
+static void make_logs (bench_random& r, std::size_t n, std::string& out)
+{
+    static char const* const levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+    std::uint64_t ms = 1500000000000ULL;
+    char stamp[64];
+    while (out.size () < n) {
+        ms += r.next () % 250;
+        std::uint64_t const t = ms / 1000;
+        std::snprintf (stamp, sizeof stamp,
+            "2017-%02d-%02dT%02d:%02d:%02d.%03dZ host-%02d ",
+            static_cast<int> (t / 2592000 % 12 + 1),
+            static_cast<int> (t / 86400 % 28 + 1),
+            static_cast<int> (t / 3600 % 24), static_cast<int> (t / 60 % 60),
+            static_cast<int> (t % 60), static_cast<int> (ms % 1000),
+            static_cast<int> (r.skewed (16)));
+        out += stamp;
+        out += word (r) + "d[" + std::to_string (1000 + r.skewed (50)) + "]: "
+            + levels[r.skewed (4)] + " " + word (r) + " " + word (r)
+            + " ip=10.0." + std::to_string (r.skewed (256)) + "."
+            + std::to_string (r.next () % 256)
+            + " status=" + std::to_string (r.skewed (4) == 0 ? 200 : 404)
+            + " latency=" + std::to_string (r.skewed (2000)) + "ms\n";
+    }
+}
+
+static void make_random (bench_random& r, std::size_t n, std::string& out)
+{
+    while (out.size () < n)
+        out.push_back (static_cast<char> (r.next () >> 56));
+}
+
+/* blocks of 4 .. 64 KiB: text, random, zeros, and binary records */
+static void make_mixed (bench_random& r, std::size_t n, std::string& out)
+{
+    std::uint32_t id = 0;
+    while (out.size () < n) {
+        std::size_t const m = std::min (n, out.size ()
+            + (r.next () % 61 + 4) * 1024);
+        switch (r.next () % 4) {
+        case 0:
+            make_text (r, m, out);
+            break;
+        case 1:
+            make_random (r, m, out);
+            break;
+        case 2:
+            out.resize (m, '\0');
+            break;
+        default:
+            while (out.size () < m) {
+                std::uint32_t const rec[4] = {id++,
+                    static_cast<std::uint32_t> (r.skewed (100)),
+                    static_cast<std::uint32_t> (r.next () >> 40),
+                    0x3f800000U + static_cast<std::uint32_t> (r.skewed (1 << 16))};
+                out.append (reinterpret_cast<char const*> (rec), sizeof rec);
+            }
+            break;
+        }
+    }
+    out.resize (n);
+}
+
+struct bench_corpus {
+    char const* name;
+    void (*make) (bench_random& r, std::size_t n, std::string& out);
+};
+
+static bench_corpus const corpora[] = {
+    {"text", make_text}, {"source", make_source}, {"logs", make_logs},
+    {"random", make_random}, {"zeros", nullptr}, {"mixed", make_mixed}
+};
+
+static std::string make_corpus (bench_corpus const& c, std::size_t n)
+{
+    bench_random r (0x9e3779b97f4a7c15ULL);
+    std::string out;
+    out.reserve (n + 4096);
+    if (c.make != nullptr)
+        c.make (r, n, out);
+    out.resize (n, '\0');
+    return out;
+}
+
+struct bench_case {
+    int corpus;
+    int format;
+    int profile;
+    int flush;
+    int nthreads;
+};
+
+static char const* format_name (int const format)
+{
+    return format == FORMAT_ZLIB ? "zlib" : format == FORMAT_RAW ? "raw" : "gzip";
+}
+
+static char const* profile_name (int const profile)
+{
+    return profile == PROFILE_SMALL ? "small" : "default";
+}
+
+static char const* strategy_name (int const flush)
+{
+    return flush == STREAM_SYNC_FLUSH ? "sync-flush"
+        : flush == STREAM_FULL_FLUSH ? "full-flush" : "default";
+}
+
+/* the stream of the calling thread for the format and the profile,
+ * reset for use
+ */
+static deflate_stream_base& bench_stream (int format, int profile)
+{
+    static thread_local std::unique_ptr<deflate_stream_base> streams[4][2];
+    std::unique_ptr<deflate_stream_base>& z = streams[format][profile];
+    if (! z)
+        z = make_deflate_stream (format, profile);
+    else
+        z->reset ();
+    return *z;
+}
+
+static std::size_t compress_part (int format, int profile, int flush,
+    std::uint8_t const* p, std::size_t n, std::vector<std::uint8_t>& out)
+{
+    deflate_stream_base& z = bench_stream (format, profile);
+    std::uint8_t* next_out = out.data ();
+    std::size_t avail_out = out.size ();
+    std::size_t const step = flush == STREAM_FINISH ? n : FLUSHSIZE;
+    std::size_t off = 0;
+    for (;;) {
+        std::uint8_t const* next_in = p + off;
+        std::size_t avail_in = std::min (step, n - off);
+        off += avail_in;
+        int const mode = off == n ? STREAM_FINISH : flush;
+        if (z.compress (next_in, avail_in, next_out, avail_out, mode)
+                == STREAM_OUTPUT_FULL)
+            throw std::runtime_error ("bench: short compression buffer.");
+        if (off == n)
+            return next_out - out.data ();
+    }
+}
+
+static void decompress_part (int format, std::uint8_t const* p,
+    std::size_t n, std::uint8_t* out, std::size_t size)
+{
+    inflate_stream& z = thread_inflate_stream (format);
+    std::uint8_t* next_out = out;
+    std::size_t avail_out = size;
+    for (;;) {
+        int const r = z.decompress (p, n, next_out, avail_out);
+        if (r == STREAM_END && (n == 0 || format != FORMAT_GZIP))
+            break;
+        if (r == STREAM_NEED_INPUT)
+            throw std::runtime_error ("bench: unexpected end of input.");
+        if (r == STREAM_OUTPUT_FULL)
+            throw std::runtime_error ("bench: decompressed size mismatch.");
+    }
+    if (avail_out != 0)
+        throw std::runtime_error ("bench: decompressed size mismatch.");
+}
+
+static double seconds_since (std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double> (
+        std::chrono::steady_clock::now () - t0).count ();
+}
+
+/* run the case in the calling process, and tell the JSON object */
+static std::string run_case (bench_case const& c, std::size_t size,
+    int repeat, double budget)
+{
+    std::string const input = make_corpus (corpora[c.corpus], size);
+    std::uint8_t const* in = reinterpret_cast<std::uint8_t const*> (input.data ());
+    /* a part for each thread at least, and 1 MiB at most */
+    std::size_t const nparts = c.nthreads == 1 ? 1
+        : std::max<std::size_t> (c.nthreads, (size + PARTSIZE - 1) / PARTSIZE);
+    auto offset = [&](std::size_t k) { return size * k / nparts; };
+    std::vector<std::vector<std::uint8_t>> parts (nparts);
+    std::vector<std::size_t> lengths (nparts);
+    for (std::size_t k = 0; k < nparts; ++k) {
+        std::size_t const n = offset (k + 1) - offset (k);
+        parts[k].resize (n + n / 8 + n / 1024 + 5 * (n / FLUSHSIZE + 1) + 1024);
+    }
+    std::vector<std::uint8_t> output (size);
+    thread_pool pool (c.nthreads);
+    auto each_part = [&](std::function<void(std::size_t)> const& task) {
+        if (c.nthreads == 1)
+            task (0);
+        else {
+            for (std::size_t k = 0; k < nparts; ++k)
+                pool.submit ([&task, k]{ task (k); });
+            pool.wait ();
+        }
+    };
+    /* made once, so that the calls allocate nothing of the harness */
+    std::function<void(std::size_t)> const compress = [&](std::size_t k) {
+        lengths[k] = compress_part (c.format, c.profile, c.flush,
+            in + offset (k), offset (k + 1) - offset (k), parts[k]);
+    };
+    std::function<void(std::size_t)> const decompress = [&](std::size_t k) {
+        decompress_part (c.format, parts[k].data (), lengths[k],
+            output.data () + offset (k), offset (k + 1) - offset (k));
+    };
+    double ctime = 0, dtime = 0;
+    long calloc = 0, cbytes = 0, dalloc = 0, dbytes = 0;
+    int runs = 0;
+    double total = 0;
+    for (int i = 0; i < repeat && (i == 0 || total < budget); ++i) {
+        long const a0 = allocations, b0 = allocated_bytes;
+        auto t0 = std::chrono::steady_clock::now ();
+        each_part (compress);
+        double const t1 = seconds_since (t0);
+        long const a1 = allocations, b1 = allocated_bytes;
+        t0 = std::chrono::steady_clock::now ();
+        each_part (decompress);
+        double const t2 = seconds_since (t0);
+        calloc = a1 - a0;
+        cbytes = b1 - b0;
+        dalloc = allocations - a1;
+        dbytes = allocated_bytes - b1;
+        ctime = i == 0 ? t1 : std::min (ctime, t1);
+        dtime = i == 0 ? t2 : std::min (dtime, t2);
+        total += t1 + t2;
+        ++runs;
+    }
+    if (! std::equal (output.begin (), output.end (), in))
+        throw std::runtime_error ("bench: round trip mismatch.");
+    std::size_t csize = 0;
+    for (std::size_t n : lengths)
+        csize += n;
+    struct rusage ru;
+    ::getrusage (RUSAGE_SELF, &ru);
+    double const mb = size / 1e6;
+    std::ostringstream json;
+    json.setf (std::ios::fixed);
+    json.precision (3);
+    json << "{\"corpus\": \"" << corpora[c.corpus].name << "\""
+         << ", \"format\": \"" << format_name (c.format) << "\""
+         << ", \"level\": \"" << profile_name (c.profile) << "\""
+         << ", \"strategy\": \"" << strategy_name (c.flush) << "\""
+         << ", \"threads\": " << c.nthreads
+         << ", \"runs\": " << runs
+         << ", \"input_bytes\": " << size
+         << ", \"compressed_bytes\": " << csize
+         << ", \"ratio\": " << (csize > 0 ? static_cast<double> (size) / csize : 0.0)
+         << ", \"compress_mbps\": " << (ctime > 0 ? mb / ctime : 0.0)
+         << ", \"decompress_mbps\": " << (dtime > 0 ? mb / dtime : 0.0)
+         << ", \"peak_rss_kib\": " << ru.ru_maxrss
+         << ", \"compress_allocations\": " << calloc
+         << ", \"compress_allocated_bytes\": " << cbytes
+         << ", \"decompress_allocations\": " << dalloc
+         << ", \"decompress_allocated_bytes\": " << dbytes << "}";
+    return json.str ();
+}
+
+/* fork the case, and take its JSON object through a pipe */
+static bool fork_case (bench_case const& c, std::size_t size, int repeat,
+    double budget, std::string& json)
+{
+    int fd[2];
+    if (::pipe (fd) < 0)
+        throw std::runtime_error ("bench: cannot create a pipe.");
+    pid_t const pid = ::fork ();
+    if (pid < 0)
+        throw std::runtime_error ("bench: cannot fork.");
+    if (pid == 0) {
+        ::close (fd[0]);
+        int status = EXIT_SUCCESS;
+        try {
+            json = run_case (c, size, repeat, budget);
+        }
+        catch (std::exception& e) {
+            json = e.what ();
+            status = EXIT_FAILURE;
+        }
+        for (std::size_t done = 0; done < json.size ();) {
+            ssize_t const n = ::write (fd[1], json.data () + done,
+                json.size () - done);
+            if (n <= 0)
+                break;
+            done += n;
+        }
+        ::_exit (status);
+    }
+    ::close (fd[1]);
+    json.clear ();
+    char buf[4096];
+    for (ssize_t n; (n = ::read (fd[0], buf, sizeof buf)) > 0;)
+        json.append (buf, n);
+    ::close (fd[0]);
+    int status;
+    ::waitpid (pid, &status, 0);
+    return WIFEXITED (status) && WEXITSTATUS (status) == EXIT_SUCCESS;
+}
+
+}// namespace deflate
+
+static void usage ()
+{
+    std::cerr << "usage: cxxgzip-bench [-s MiB] [-n repeat] [-t seconds] [-p threads,...]\n"
+                 "                     [-f gzip,zlib,raw] [-l default,small] > bench.json\n";
+    std::exit (EXIT_FAILURE);
+}
+
+static std::vector<std::string> split_list (std::string const& s)
+{
+    std::vector<std::string> list;
+    std::istringstream in (s);
+    for (std::string item; std::getline (in, item, ',');)
+        if (! item.empty ())
+            list.push_back (item);
+    return list;
+}
+
+int main (int argc, char* argv[])
+{
+    std::size_t size = 256 * 1024;
+    int repeat = 3;
+    double budget = 2.0;
+    std::vector<int> threads;
+    /* 1, 2, 4, ... up to the cores */
+    for (unsigned n = 1; n <= std::max (1U, std::thread::hardware_concurrency ()); n *= 2)
+        threads.push_back (n);
+    std::vector<int> formats {deflate::FORMAT_GZIP};
+    std::vector<int> profiles {deflate::PROFILE_DEFAULT, deflate::PROFILE_SMALL};
+
+    for (int i = 1; i < argc; ++i) {
+        std::string opt (argv[i]);
+        if (opt == "-s" && i + 1 < argc)
+            size = static_cast<std::size_t> (std::atof (argv[++i]) * 1024 * 1024);
+        else if (opt == "-n" && i + 1 < argc)
+            repeat = std::max (1, std::atoi (argv[++i]));
+        else if (opt == "-t" && i + 1 < argc)
+            budget = std::atof (argv[++i]);
+        else if (opt == "-p" && i + 1 < argc) {
+            threads.clear ();
+            for (std::string const& t : split_list (argv[++i]))
+                threads.push_back (std::max (1, std::atoi (t.c_str ())));
+        }
+        else if (opt == "-f" && i + 1 < argc) {
+            formats.clear ();
+            for (std::string const& f : split_list (argv[++i]))
+                if (f == "gzip")
+                    formats.push_back (deflate::FORMAT_GZIP);
+                else if (f == "zlib")
+                    formats.push_back (deflate::FORMAT_ZLIB);
+                else if (f == "raw")
+                    formats.push_back (deflate::FORMAT_RAW);
+                else
+                    usage ();
+        }
+        else if (opt == "-l" && i + 1 < argc) {
+            profiles.clear ();
+            for (std::string const& l : split_list (argv[++i]))
+                if (l == "default")
+                    profiles.push_back (deflate::PROFILE_DEFAULT);
+                else if (l == "small")
+                    profiles.push_back (deflate::PROFILE_SMALL);
+                else
+                    usage ();
+        }
+        else
+            usage ();
+    }
+    if (threads.empty () || formats.empty () || profiles.empty ())
+        usage ();
+    std::vector<deflate::bench_case> cases;
+    int const ncorpora = sizeof (deflate::corpora) / sizeof (deflate::corpora[0]);
+    int const flushes[] = {deflate::STREAM_FINISH,
+        deflate::STREAM_SYNC_FLUSH, deflate::STREAM_FULL_FLUSH};
+    for (int corpus = 0; corpus < ncorpora; ++corpus)
+        for (int format : formats)
+            for (int profile : profiles)
+                for (int flush : flushes)
+                    for (int nthreads : threads)
+                        /* only gzip members are concatenated */
+                        if (nthreads == 1 || format == deflate::FORMAT_GZIP)
+                            cases.push_back ({corpus, format, profile, flush,
+                                nthreads});
+    std::cout << "{\n  \"program\": \"cxxgzip\",\n  \"version\": \"0.0.1\",\n"
+              << "  \"corpus_bytes\": " << size << ",\n"
+              << "  \"repeat\": " << repeat << ",\n"
+              << "  \"seconds\": " << budget << ",\n"
+              << "  \"hardware_threads\": " << std::thread::hardware_concurrency ()
+              << ",\n  \"results\": [";
+    bool ok = true;
+    bool first = true;
+    for (std::size_t i = 0; i < cases.size (); ++i) {
+        std::string json;
+        deflate::bench_case const& c = cases[i];
+        std::cerr << deflate::corpora[c.corpus].name << " "
+                  << deflate::format_name (c.format) << " "
+                  << deflate::profile_name (c.profile) << " "
+                  << deflate::strategy_name (c.flush) << " "
+                  << c.nthreads << std::endl;
+        try {
+            if (! deflate::fork_case (c, size, repeat, budget, json)) {
+                std::cerr << "cxxgzip-bench: " << json << std::endl;
+                ok = false;
+                continue;
+            }
+        }
+        catch (std::exception& e) {
+            std::cerr << e.what () << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << (first ? "\n    " : ",\n    ") << json;
+        first = false;
+    }
+    std::cout << "\n  ]\n}\n";
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
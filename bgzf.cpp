@@ -0,0 +1,230 @@
+/* BGZF (blocked gzip) compression and parallel decompression
+ *
+ *  1. each member holds at most 0xff00 bytes of input, so that it fits
+ *     in 64 KiB after the compression.
+ *  2. the BC extra subfield holds BSIZE, the member size minus one.
+ *  3. an empty member terminates the file as the EOF marker.
+ *  4. the members are compressed on the reusable streams of the pool
+ *     threads, while the next batch of the input is read.
+ *  5. a virtual offset is (compressed offset of a member << 16)
+ *     | (offset in its uncompressed data).
+ *
+ * References:
+ *
+ *  P. Deutsch, ``RFC 1952 GZIP file format specification version 4.3'', 1996
+ *  ``The SAM/BAM Format Specification'', 4.1 The BGZF compression format
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+enum {
+    BGZF_BLOCKSIZE = 0xff00,
+    BGZF_MAXSIZE = 65536,
+    BGZF_HEADERSIZE = 18,
+    BGZF_TRAILERSIZE = 8,
+    BGZF_BATCH = 8
+};
+
+struct bgzf_job {
+    std::string input;
+    std::string output;
+    stream_stats stats;
+};
+
+static void put_bgzf_header (std::uint8_t* p, std::uint32_t bsize)
+{
+    static std::uint8_t const header[16] = {
+        0x1f, 0x8b, 8,
+        4,                  /* FEXTRA */
+        0, 0, 0, 0, 0,
+        0xff,               /* unknown OS */
+        6, 0,               /* XLEN */
+        'B', 'C', 2, 0
+    };
+    std::copy (header, header + sizeof header, p);
+    p[16] = bsize & 0xff;
+    p[17] = bsize >> 8;
+}
+
+/* the member goes out from the stream with a bare header, after the room
+ * for the longer header of BGZF, which takes the place of the bare one.
+ */
+static void bgzf_deflate_block (bgzf_job& job)
+{
+    std::string& out = job.output;
+    out.assign (BGZF_HEADERSIZE - 10, '\0');
+    compress_span (FORMAT_GZIP,
+        reinterpret_cast<std::uint8_t const*> (job.input.data ()),
+        job.input.size (), [&out](std::uint8_t const* p, std::size_t n) {
+            out.append (reinterpret_cast<char const*> (p), n);
+        });
+    if (out.size () > BGZF_MAXSIZE)
+        throw std::runtime_error ("bgzf: compressed block overflow.");
+    put_bgzf_header (reinterpret_cast<std::uint8_t*> (&out[0]), out.size () - 1);
+}
+
+static void bgzf_inflate_block (bgzf_job& job, bool const counted)
+{
+    std::istringstream cin (job.input);
+    std::ostringstream cout;
+    job.stats.clear ();
+    gunzip_member (cin, &cout, counted ? &job.stats : nullptr);
+    job.output = cout.str ();
+}
+
+/* read the inputs of a batch of members, and return how many */
+static std::size_t bgzf_read_batch (std::istream& cin,
+    std::vector<bgzf_job>& jobs, bool& eof)
+{
+    std::size_t n = 0;
+    for (; n < jobs.size () && ! eof; ++n) {
+        std::string& s = jobs[n].input;
+        s.resize (BGZF_BLOCKSIZE);
+        cin.read (&s[0], BGZF_BLOCKSIZE);
+        s.resize (cin.gcount ());
+        if (s.size () < BGZF_BLOCKSIZE)
+            eof = true;
+        if (s.empty ())
+            break;
+    }
+    return n;
+}
+
+void bgzf_compress (std::istream& cin, std::ostream& cout, int nthreads)
+{
+    thread_pool pool (nthreads);
+    /* a batch is compressed while the other is read */
+    std::vector<bgzf_job> jobs[2];
+    jobs[0].resize (BGZF_BATCH * std::max (nthreads, 1));
+    jobs[1].resize (jobs[0].size ());
+    bool eof = false;
+    std::size_t n = bgzf_read_batch (cin, jobs[0], eof);
+    for (int k = 0; n > 0; k = 1 - k) {
+        for (std::size_t i = 0; i < n; ++i) {
+            bgzf_job& job = jobs[k][i];
+            pool.submit ([&job]{ bgzf_deflate_block (job); });
+        }
+        std::size_t const next = eof ? 0
+            : bgzf_read_batch (cin, jobs[1 - k], eof);
+        pool.wait ();
+        for (std::size_t i = 0; i < n; ++i)
+            cout.write (jobs[k][i].output.data (), jobs[k][i].output.size ());
+        n = next;
+    }
+    /* EOF marker: an empty member */
+    bgzf_job marker;
+    bgzf_deflate_block (marker);
+    cout.write (marker.output.data (), marker.output.size ());
+}
+
+/* decode the blocks in parallel, and add their counters in order */
+static void bgzf_flush (thread_pool& pool, std::vector<bgzf_job>& jobs,
+    std::size_t n, std::uint32_t& skip, std::ostream& cout,
+    stream_stats* stats)
+{
+    bool const counted = stats != nullptr;
+    for (std::size_t i = 0; i < n; ++i) {
+        bgzf_job& job = jobs[i];
+        pool.submit ([&job, counted]{ bgzf_inflate_block (job, counted); });
+    }
+    pool.wait ();
+    for (std::size_t i = 0; i < n; ++i) {
+        if (stats != nullptr)
+            stats->merge (jobs[i].stats);
+        std::string const& s = jobs[i].output;
+        if (skip > s.size ())
+            throw std::runtime_error ("bgzf: invalid virtual offset.");
+        cout.write (s.data () + skip, s.size () - skip);
+        skip = 0;
+    }
+}
+
+/* continue from the first member header read by the caller. */
+void bgzf_decompress (std::istream& cin, std::ostream& cout,
+    gzip_header const& first, std::uint32_t skip, int nthreads,
+    stream_stats* stats)
+{
+    thread_pool pool (nthreads);
+    std::vector<bgzf_job> jobs (BGZF_BATCH * std::max (nthreads, 1));
+    std::size_t n = 0;
+    gzip_header header = first;
+    for (;;) {
+        if (header.bsize < 0) {
+            /* a plain gzip member: decode it in order by ourselves */
+            bgzf_flush (pool, jobs, n, skip, cout, stats);
+            n = 0;
+            if (skip > 0)
+                throw std::runtime_error ("bgzf: invalid virtual offset.");
+            gunzip_member (cin, &cout, stats);
+        }
+        else {
+            std::size_t const total = header.bsize + 1;
+            if (total < header.length + BGZF_TRAILERSIZE)
+                throw std::runtime_error ("bgzf: invalid BSIZE.");
+            std::string& s = jobs[n].input;
+            s.resize (total - header.length);
+            cin.read (&s[0], s.size ());
+            if (static_cast<std::size_t> (cin.gcount ()) != s.size ())
+                throw std::runtime_error ("bgzf: unexpected end-of-file.");
+            if (++n == jobs.size ()) {
+                bgzf_flush (pool, jobs, n, skip, cout, stats);
+                n = 0;
+            }
+        }
+        if (cin.peek () == EOF)
+            break;
+        bitinput input (cin);
+        read_gzip_header (input, header);
+    }
+    bgzf_flush (pool, jobs, n, skip, cout, stats);
+}
+
+void bgzf_seek (std::uint64_t voffset, int nthreads)
+{
+    std::cin.seekg (voffset >> 16);
+    if (! std::cin)
+        throw std::runtime_error ("bgzf: cannot seek input.");
+    gzip_header header;
+    bitinput input (std::cin);
+    read_gzip_header (input, header);
+    if (header.bsize < 0)
+        throw std::runtime_error ("bgzf: not a BGZF block.");
+    bgzf_decompress (std::cin, std::cout, header, voffset & 0xffff, nthreads);
+}
+
+}// namespace deflate
@@ -41,6 +41,36 @@
 
 namespace deflate {
 
+/* make the accumulator hold n bits at least, loading bytes one by one
+ * so as not to take any byte beyond the needs. the pull mode reads them
+ * from cin, and the push mode from the span fed, returning false when
+ * the span runs short.
+ */
+bool bitinput::need (int const n)
+{
+    while (bitcnt < n) {
+        int c;
+        if (cin != nullptr) {
+            c = cin->get ();
+            if (c == EOF)
+                throw std::runtime_error ("huffman_decoder: unexpected end-of-file.");
+        }
+        else if (next < end)
+            c = *next++;
+        else
+            return false;
+        bitbuf |= static_cast<std::uint64_t> (c) << bitcnt;
+        bitcnt += 8;
+    }
+    return true;
+}
+
+void bitinput::require (int const n)
+{
+    if (! need (n))
+        throw std::runtime_error ("huffman_decoder: unexpected end-of-file.");
+}
+
 void bitinput::gethuffman (int const n,
     std::uint32_t& c, int& bits, std::uint32_t& huff)
 {
@@ -71,9 +101,9 @@ void bitinput::gethuffman (std::shared_ptr<huffman_tree> tree,
 
 void bitinput::getdata (int const n, std::uint32_t& c)
 {
-    c = 0;
-    for (int i = 0; i < n; ++i)
-        c |= getbit () << i;            /* from LSB */
+    require (n);
+    c = peek (n);                       /* from LSB */
+    drop (n);
 }
 
 void bitinput::getasciiz (std::string& s)
@@ -89,32 +119,40 @@ void bitinput::getasciiz (std::string& s)
 
 std::uint32_t bitinput::get4byte ()
 {
-    return getbyte () | (getbyte () << 8) | (getbyte () << 16) | (getbyte () << 24);
+    std::uint32_t c = getbyte ();
+    c |= getbyte () << 8;
+    c |= getbyte () << 16;
+    return c | (getbyte () << 24);
+}
+
+std::uint32_t bitinput::get4byte_bigendian ()
+{
+    std::uint32_t c = getbyte () << 24;
+    c |= getbyte () << 16;
+    c |= getbyte () << 8;
+    return c | getbyte ();
 }
 
 std::uint32_t bitinput::get2byte ()
 {
-    return getbyte () | (getbyte () << 8);
+    std::uint32_t c = getbyte ();
+    return c | (getbyte () << 8);
 }
 
+/* skip the rest bits of the current byte, and get the next byte. */
 std::uint32_t bitinput::getbyte ()
 {
-    bitpos = 8;
-    int c = cin.get ();
-    if (c == EOF)
-        throw std::runtime_error ("huffman_decoder: unexpected end-of-file.");
-    bitbuf = static_cast<std::uint32_t> (c);
-    return bitbuf;
+    align ();
+    std::uint32_t c;
+    getdata (8, c);
+    return c;
 }
 
 std::uint32_t bitinput::getbit ()
 {
-    if (bitpos > 7) {
-        getbyte ();
-        bitpos = 0;
-    }
-    return (bitbuf >> (bitpos++)) & 0x01;   /* from LSB to MSB */
+    std::uint32_t c;
+    getdata (1, c);                     /* from LSB to MSB */
+    return c;
 }
 
 }// namespace deflate
-
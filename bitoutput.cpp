@@ -36,6 +36,7 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include "deflate.hpp"
 
 namespace deflate {
@@ -60,6 +61,14 @@ void bitoutput::put4byte (std::uint32_t const data)
     putbyte ((data >> 24) & 0xffL);
 }
 
+void bitoutput::put4byte_bigendian (std::uint32_t const data)
+{
+    putbyte ((data >> 24) & 0xffL);     /* big endian */
+    putbyte ((data >> 16) & 0xffL);
+    putbyte ((data >> 8) & 0xffL);
+    putbyte (data & 0xffL);
+}
+
 void bitoutput::put2byte (std::uint32_t const data)
 {
     putbyte (data & 0xffL);             /* little endian */
@@ -68,12 +77,8 @@ void bitoutput::put2byte (std::uint32_t const data)
 
 void bitoutput::putbyte (std::uint32_t const data)
 {
-    if (bitpos != 0) {
-        cout.put (bitbuf);
-        bitpos = 0;
-        bitbuf = 0;
-    }
-    cout.put (data);
+    align ();
+    putraw (data);
 }
 
 void bitoutput::putbit (std::uint32_t const data)
@@ -81,11 +86,54 @@ void bitoutput::putbit (std::uint32_t const data)
     bitbuf |= (data & 0x01L) << bitpos; /* from LSB to MSB */
     ++bitpos;
     if (bitpos > 7) {
-        cout.put (bitbuf);
+        putraw (bitbuf);
+        bitpos = 0;
+        bitbuf = 0;
+    }
+}
+
+/* pad the partial byte with zero bits */
+void bitoutput::align ()
+{
+    if (bitpos != 0) {
+        putraw (bitbuf);
         bitpos = 0;
         bitbuf = 0;
     }
 }
 
+/* the pull mode writes out pending bytes into cout at every 64 KiB. */
+void bitoutput::putraw (std::uint32_t const data)
+{
+    obuf.push_back (data);
+    if (cout != nullptr && obuf.size () >= OBUFSIZE) {
+        cout->write (obuf.data (), obuf.size ());
+        obuf.clear ();
+    }
+}
+
+/* the push mode takes pending bytes into the caller's buffer. */
+std::size_t bitoutput::drain (std::uint8_t* p, std::size_t n)
+{
+    n = std::min (n, obuf.size () - ohead);
+    std::copy (obuf.begin () + ohead, obuf.begin () + ohead + n, p);
+    ohead += n;
+    if (ohead == obuf.size ()) {
+        obuf.clear ();
+        ohead = 0;
+    }
+    return n;
+}
+
+/* pad the partial byte, and write out pending bytes into cout */
+void bitoutput::flush ()
+{
+    align ();
+    if (cout != nullptr) {
+        cout->write (obuf.data (), obuf.size ());
+        obuf.clear ();
+    }
+}
+
 }// namespace deflate
 
@@ -0,0 +1,313 @@
+/* C interface of the Deflate + gzip (de)compression library
+ *
+ *  1. the one-shot calls run the push-mode streams over the whole
+ *     buffers at once.
+ *  2. exceptions are caught at the boundary, and their messages are
+ *     kept per thread for cxxgzip_last_error.
+ *  3. a stream handle refuses further calls after an error.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include "deflate.hpp"
+#include "cxxgzip.h"
+
+struct cxxgzip_stream {
+    std::unique_ptr<deflate::deflate_stream_base> deflater;
+    std::unique_ptr<deflate::inflate_stream> inflater;
+    std::unique_ptr<deflate::stream_stats> stats;
+    bool failed;
+};
+
+namespace deflate {
+
+static thread_local std::string last_error;
+
+static int capi_error (char const* message)
+{
+    last_error = message;
+    return CXXGZIP_ERROR;
+}
+
+static void check_format (int const format)
+{
+    if (format != FORMAT_GZIP && format != FORMAT_ZLIB && format != FORMAT_RAW)
+        throw std::runtime_error ("cxxgzip: unsupported format.");
+}
+
+}// namespace deflate
+
+using namespace deflate;
+
+size_t cxxgzip_compress_bound (size_t srclen)
+{
+    /* a block is never longer than its fixed Huffman coding, as the
+     * dynamic and the stored ones are taken only when shorter. the fixed
+     * codes take at most 9 bits a literal, and 25 bits a match of 3 bytes
+     * or more, so 9 bits a byte, and 10 bits a block for the header and
+     * the end of block. the blocks hold 2044 bytes at least, those of the
+     * small profile. then the gzip header and trailer, and the alignment.
+     */
+    return srclen + srclen / 8 + srclen / 1024 + 64;
+}
+
+int cxxgzip_compress (int format, void const* src, size_t srclen,
+    void* dst, size_t* dstlen)
+{
+    try {
+        check_format (format);
+        deflate_stream& z = thread_deflate_stream (format);
+        std::uint8_t const* next_in = static_cast<std::uint8_t const*> (src);
+        std::uint8_t* next_out = static_cast<std::uint8_t*> (dst);
+        std::size_t avail_out = *dstlen;
+        int r = z.compress (next_in, srclen, next_out, avail_out,
+            STREAM_FINISH);
+        *dstlen -= avail_out;
+        return r == STREAM_END ? CXXGZIP_OK : CXXGZIP_OUTPUT_FULL;
+    }
+    catch (std::exception& e) {
+        return capi_error (e.what ());
+    }
+}
+
+int cxxgzip_decompress (int format, void const* src, size_t srclen,
+    void* dst, size_t* dstlen)
+{
+    try {
+        check_format (format);
+        inflate_stream& z = thread_inflate_stream (format);
+        std::uint8_t const* next_in = static_cast<std::uint8_t const*> (src);
+        std::uint8_t* next_out = static_cast<std::uint8_t*> (dst);
+        std::size_t avail_out = *dstlen;
+        int r = STREAM_END;
+        /* a gzip stream ends at each member, and the others once */
+        do
+            r = z.decompress (next_in, srclen, next_out, avail_out);
+        while (r == STREAM_END && srclen > 0
+            && (format == FORMAT_GZIP || format == FORMAT_BGZF));
+        *dstlen -= avail_out;
+        if (r == STREAM_NEED_INPUT)
+            throw std::runtime_error ("cxxgzip: unexpected end of input.");
+        if (r == STREAM_END && srclen > 0)
+            throw std::runtime_error ("cxxgzip: trailing garbage.");
+        return r == STREAM_END ? CXXGZIP_OK : CXXGZIP_OUTPUT_FULL;
+    }
+    catch (std::exception& e) {
+        return capi_error (e.what ());
+    }
+}
+
+cxxgzip_stream* cxxgzip_deflate_new (int format)
+{
+    return cxxgzip_deflate_new_profile (format, CXXGZIP_PROFILE_DEFAULT);
+}
+
+cxxgzip_stream* cxxgzip_deflate_new_profile (int format, int profile)
+{
+    try {
+        check_format (format);
+        std::unique_ptr<deflate_stream_base> d
+            = make_deflate_stream (format, profile);
+        cxxgzip_stream* z = new cxxgzip_stream ();
+        z->deflater = std::move (d);
+        z->failed = false;
+        return z;
+    }
+    catch (std::exception& e) {
+        capi_error (e.what ());
+        return nullptr;
+    }
+}
+
+cxxgzip_stream* cxxgzip_inflate_new (int format)
+{
+    try {
+        check_format (format);
+        cxxgzip_stream* z = new cxxgzip_stream ();
+        z->inflater.reset (new inflate_stream (format));
+        z->failed = false;
+        return z;
+    }
+    catch (std::exception& e) {
+        capi_error (e.what ());
+        return nullptr;
+    }
+}
+
+int cxxgzip_reset (cxxgzip_stream* z)
+{
+    if (z == nullptr)
+        return capi_error ("cxxgzip: not a stream.");
+    try {
+        if (z->deflater)
+            z->deflater->reset ();
+        else
+            z->inflater->reset ();
+        z->failed = false;
+        return CXXGZIP_OK;
+    }
+    catch (std::exception& e) {
+        z->failed = true;
+        return capi_error (e.what ());
+    }
+}
+
+int cxxgzip_deflate_rsyncable (cxxgzip_stream* z, int on)
+{
+    if (z == nullptr || ! z->deflater)
+        return capi_error ("cxxgzip: not a deflate stream.");
+    z->deflater->set_rsyncable (on != 0);
+    return CXXGZIP_OK;
+}
+
+int cxxgzip_deflate (cxxgzip_stream* z,
+    uint8_t const** next_in, size_t* avail_in,
+    uint8_t** next_out, size_t* avail_out, int flush)
+{
+    if (z == nullptr || ! z->deflater)
+        return capi_error ("cxxgzip: not a deflate stream.");
+    if (z->failed)
+        return capi_error ("cxxgzip: stream in error.");
+    if (flush < CXXGZIP_NO_FLUSH || flush > CXXGZIP_FULL_FLUSH)
+        return capi_error ("cxxgzip: unknown flush mode.");
+    try {
+        return z->deflater->compress (*next_in, *avail_in,
+            *next_out, *avail_out, flush);
+    }
+    catch (std::exception& e) {
+        z->failed = true;
+        return capi_error (e.what ());
+    }
+}
+
+int cxxgzip_inflate (cxxgzip_stream* z,
+    uint8_t const** next_in, size_t* avail_in,
+    uint8_t** next_out, size_t* avail_out)
+{
+    if (z == nullptr || ! z->inflater)
+        return capi_error ("cxxgzip: not an inflate stream.");
+    if (z->failed)
+        return capi_error ("cxxgzip: stream in error.");
+    try {
+        return z->inflater->decompress (*next_in, *avail_in,
+            *next_out, *avail_out);
+    }
+    catch (std::exception& e) {
+        z->failed = true;
+        return capi_error (e.what ());
+    }
+}
+
+void cxxgzip_free (cxxgzip_stream* z)
+{
+    delete z;
+}
+
+int cxxgzip_stats_enable (cxxgzip_stream* z)
+{
+    if (z == nullptr)
+        return capi_error ("cxxgzip: not a stream.");
+    try {
+        if (! z->stats)
+            z->stats.reset (new stream_stats ());
+        z->stats->clear ();
+        if (z->deflater)
+            z->deflater->set_stats (z->stats.get ());
+        else
+            z->inflater->set_stats (z->stats.get ());
+        return CXXGZIP_OK;
+    }
+    catch (std::exception& e) {
+        return capi_error (e.what ());
+    }
+}
+
+int cxxgzip_get_stats (cxxgzip_stream const* z, cxxgzip_stats* stats,
+    size_t* nblocks)
+{
+    if (z == nullptr || ! z->stats)
+        return capi_error ("cxxgzip: no statistics on the stream.");
+    stream_stats const& s = *z->stats;
+    block_stats const t = s.total ();
+    std::memset (stats, 0, sizeof (*stats));
+    stats->input = s.input;
+    stats->output = s.output;
+    for (block_stats const& b : s.blocks)
+        ++stats->blocks[b.type];
+    stats->bytes = t.bytes;
+    stats->literals = t.literals;
+    stats->matches = t.matches;
+    std::copy (s.lengths, s.lengths + 29, stats->lengths);
+    std::copy (s.distances, s.distances + 30, stats->distances);
+    stats->searches = s.searches;
+    stats->candidates = s.candidates;
+    stats->max_candidates = s.max_candidates;
+    stats->lazy_tries = s.lazy_tries;
+    stats->lazy_hits = s.lazy_hits;
+    stats->match_ns = s.match_ns;
+    stats->table_ns = s.table_ns;
+    stats->output_ns = s.output_ns;
+    stats->digest_ns = s.digest_ns;
+    stats->decode_ns = s.decode_ns;
+    if (nblocks != nullptr)
+        *nblocks = s.blocks.size ();
+    return CXXGZIP_OK;
+}
+
+int cxxgzip_get_block_stats (cxxgzip_stream const* z, size_t i,
+    cxxgzip_block_stats* block)
+{
+    if (z == nullptr || ! z->stats)
+        return capi_error ("cxxgzip: no statistics on the stream.");
+    if (i >= z->stats->blocks.size ())
+        return capi_error ("cxxgzip: no such block.");
+    block_stats const& b = z->stats->blocks[i];
+    block->type = b.type;
+    block->final = b.final;
+    block->bytes = b.bytes;
+    block->literals = b.literals;
+    block->matches = b.matches;
+    block->bits = b.bits;
+    block->hlit = b.hlit;
+    block->hdist = b.hdist;
+    block->hclen = b.hclen;
+    block->table_bits = b.table_bits;
+    return CXXGZIP_OK;
+}
+
+char const* cxxgzip_last_error (void)
+{
+    return last_error.c_str ();
+}
@@ -0,0 +1,275 @@
+/* checks of the library run by make check
+ *
+ *  1. random bytes, the worst case of the compression, fit in
+ *     cxxgzip_compress_bound for each format and profile, and come back
+ *     the same.
+ *  2. after a first round, compressing and decompressing again makes no
+ *     heap allocations, in the one-shot calls and in the streams started
+ *     over by cxxgzip_reset. a counting operator new sees them.
+ *  3. the one-shot decompression rejects bytes after a zlib or raw
+ *     stream, and takes them as the next member of a gzip stream.
+ *  4. the program exits with 1 when a check fails, telling which.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "cxxgzip.h"
+
+static int nfailed = 0;
+static std::atomic<long> allocations (0);
+
+void* operator new (std::size_t n)
+{
+    ++allocations;
+    void* p = std::malloc (n == 0 ? 1 : n);
+    if (p == nullptr)
+        throw std::bad_alloc ();
+    return p;
+}
+
+void operator delete (void* p) noexcept
+{
+    std::free (p);
+}
+
+void operator delete (void* p, std::size_t) noexcept
+{
+    std::free (p);
+}
+
+static void check (bool const ok, std::string const& what)
+{
+    if (ok)
+        return;
+    ++nfailed;
+    std::cerr << "FAILED " << what << std::endl;
+}
+
+/* xorshift64: incompressible bytes from a fixed seed */
+static std::vector<std::uint8_t> random_bytes (std::size_t n)
+{
+    std::uint64_t s = 88172645463325252ULL;
+    std::vector<std::uint8_t> v (n);
+    for (std::size_t i = 0; i < n; ++i) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        v[i] = s >> 24;
+    }
+    return v;
+}
+
+/* compress into exactly the bound with a stream of the profile */
+static bool compress_bounded (int format, int profile,
+    std::vector<std::uint8_t> const& input, std::vector<std::uint8_t>& output)
+{
+    output.resize (cxxgzip_compress_bound (input.size ()));
+    cxxgzip_stream* z = cxxgzip_deflate_new_profile (format, profile);
+    if (z == nullptr)
+        return false;
+    std::uint8_t const* next_in = input.data ();
+    std::size_t avail_in = input.size ();
+    std::uint8_t* next_out = output.data ();
+    std::size_t avail_out = output.size ();
+    int const r = cxxgzip_deflate (z, &next_in, &avail_in,
+        &next_out, &avail_out, CXXGZIP_FINISH);
+    cxxgzip_free (z);
+    output.resize (output.size () - avail_out);
+    return r == CXXGZIP_STREAM_END;
+}
+
+static void check_bound ()
+{
+    int const formats[] = {
+        CXXGZIP_FORMAT_GZIP, CXXGZIP_FORMAT_ZLIB, CXXGZIP_FORMAT_RAW
+    };
+    std::size_t const sizes[] = {0, 1, 100, 65535, 65536, 200000, 3000000};
+    for (std::size_t n : sizes) {
+        std::vector<std::uint8_t> const input = random_bytes (n);
+        for (int format : formats) {
+            std::string const what = "bound: format " + std::to_string (format)
+                + ", " + std::to_string (n) + " bytes";
+            std::vector<std::uint8_t> output (cxxgzip_compress_bound (n));
+            std::size_t len = output.size ();
+            check (cxxgzip_compress (format, input.data (), n,
+                output.data (), &len) == CXXGZIP_OK, what + ", one-shot");
+            std::vector<std::uint8_t> back (n + 1);
+            std::size_t backlen = back.size ();
+            check (cxxgzip_decompress (format, output.data (), len,
+                back.data (), &backlen) == CXXGZIP_OK && backlen == n
+                && std::equal (input.begin (), input.end (), back.begin ()),
+                what + ", round trip");
+            check (compress_bounded (format, CXXGZIP_PROFILE_SMALL,
+                input, output), what + ", small profile");
+        }
+    }
+}
+
+/* words from a small vocabulary, which compress with matches and
+ * dynamic blocks, plus a random tail taking stored blocks.
+ */
+static std::vector<std::uint8_t> text_bytes (std::size_t n)
+{
+    static char const* const words[] = {
+        "deflate ", "inflate ", "stream ", "block ", "window ", "reset ",
+        "huffman ", "match ", "literal ", "\n"
+    };
+    std::vector<std::uint8_t> const noise = random_bytes (n);
+    std::vector<std::uint8_t> v;
+    v.reserve (n);
+    for (std::size_t i = 0; v.size () < n / 2; ++i)
+        for (char const* p = words[noise[i] % 10]; *p != '\0'; ++p)
+            v.push_back (*p);
+    v.insert (v.end (), noise.begin () + v.size (), noise.end ());
+    return v;
+}
+
+/* a stream to its end, from the start of input into the whole output */
+static bool pump (cxxgzip_stream* z, bool deflating,
+    std::vector<std::uint8_t> const& input, std::size_t inlen,
+    std::vector<std::uint8_t>& output, std::size_t& outlen)
+{
+    std::uint8_t const* next_in = input.data ();
+    std::size_t avail_in = inlen;
+    std::uint8_t* next_out = output.data ();
+    std::size_t avail_out = output.size ();
+    int const r = deflating
+        ? cxxgzip_deflate (z, &next_in, &avail_in, &next_out, &avail_out,
+            CXXGZIP_FINISH)
+        : cxxgzip_inflate (z, &next_in, &avail_in, &next_out, &avail_out);
+    outlen = output.size () - avail_out;
+    return r == CXXGZIP_STREAM_END;
+}
+
+static void check_no_allocations ()
+{
+    enum {ROUNDS = 4};
+    int const formats[] = {
+        CXXGZIP_FORMAT_GZIP, CXXGZIP_FORMAT_ZLIB, CXXGZIP_FORMAT_RAW
+    };
+    std::vector<std::uint8_t> const input = text_bytes (300000);
+    std::vector<std::uint8_t> packed (cxxgzip_compress_bound (input.size ()));
+    std::vector<std::uint8_t> back (input.size ());
+    for (int format : formats) {
+        std::string const what = "allocations: format "
+            + std::to_string (format);
+        bool ok = true;
+        long count = 0;
+        for (int round = 0; round <= ROUNDS; ++round) {
+            long const before = allocations;
+            std::size_t len = packed.size ();
+            std::size_t backlen = back.size ();
+            ok = ok && cxxgzip_compress (format, input.data (), input.size (),
+                packed.data (), &len) == CXXGZIP_OK
+                && cxxgzip_decompress (format, packed.data (), len,
+                back.data (), &backlen) == CXXGZIP_OK
+                && backlen == input.size ();
+            if (round > 0)
+                count += allocations - before;
+        }
+        check (ok && back == input, what + ", one-shot round trip");
+        check (count == 0, what + ", one-shot: "
+            + std::to_string (count) + " allocations");
+
+        cxxgzip_stream* const zd = cxxgzip_deflate_new (format);
+        cxxgzip_stream* const zi = cxxgzip_inflate_new (format);
+        ok = zd != nullptr && zi != nullptr;
+        count = 0;
+        for (int round = 0; ok && round <= ROUNDS; ++round) {
+            long const before = allocations;
+            std::size_t len = 0;
+            std::size_t backlen = 0;
+            ok = (round == 0 || (cxxgzip_reset (zd) == CXXGZIP_OK
+                && cxxgzip_reset (zi) == CXXGZIP_OK))
+                && pump (zd, true, input, input.size (), packed, len)
+                && pump (zi, false, packed, len, back, backlen)
+                && backlen == input.size ();
+            if (round > 0)
+                count += allocations - before;
+        }
+        cxxgzip_free (zd);
+        cxxgzip_free (zi);
+        check (ok && back == input, what + ", reset round trip");
+        check (count == 0, what + ", reset streams: "
+            + std::to_string (count) + " allocations");
+    }
+}
+
+static void check_trailing ()
+{
+    int const formats[] = {
+        CXXGZIP_FORMAT_GZIP, CXXGZIP_FORMAT_ZLIB, CXXGZIP_FORMAT_RAW
+    };
+    std::vector<std::uint8_t> const input = text_bytes (1000);
+    std::vector<std::uint8_t> packed (cxxgzip_compress_bound (input.size ()));
+    std::vector<std::uint8_t> back (3 * input.size ());
+    for (int format : formats) {
+        std::string const what = "trailing: format " + std::to_string (format);
+        std::size_t len = packed.size ();
+        check (cxxgzip_compress (format, input.data (), input.size (),
+            packed.data (), &len) == CXXGZIP_OK, what + ", compress");
+        packed.resize (len);
+        std::vector<std::uint8_t> twice (packed);
+        twice.insert (twice.end (), packed.begin (), packed.end ());
+        std::size_t backlen = back.size ();
+        int const r = cxxgzip_decompress (format, twice.data (), twice.size (),
+            back.data (), &backlen);
+        if (format == CXXGZIP_FORMAT_GZIP)
+            check (r == CXXGZIP_OK && backlen == 2 * input.size (),
+                what + ", two members");
+        else
+            check (r == CXXGZIP_ERROR, what + ", a second stream");
+        packed.push_back (0);
+        backlen = back.size ();
+        check (cxxgzip_decompress (format, packed.data (), packed.size (),
+            back.data (), &backlen) == CXXGZIP_ERROR, what + ", a byte after");
+        packed.resize (cxxgzip_compress_bound (input.size ()));
+    }
+}
+
+int main ()
+{
+    check_bound ();
+    check_no_allocations ();
+    check_trailing ();
+    if (nfailed > 0)
+        return EXIT_FAILURE;
+    std::cout << "check: all passed." << std::endl;
+    return EXIT_SUCCESS;
+}
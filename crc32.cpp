@@ -1,9 +1,18 @@
 /* CRC32 calculation for gzip format
+ *
+ *  1. slicing-by-16: 16 tables of 256 entries fold 16 bytes in a step.
+ *  2. the tables are built once at the first use and shared by all digests.
+ *  3. a folding kernel takes large buffers when the CPU has it and it
+ *     passes the self-test against the bitwise reference at the start.
+ *  4. the CRC of two concatenated spans from their CRCs: multiply the
+ *     first by x^(8 len2) modulo the polynomial, in O(log len2).
  *
  * References:
  *
  *  P. Deutsch, ``RFC 1952 GZIP file format specification version 4.3'', 1996
  *     8. Appendix: Sample CRC Code
+ *  M. Kounavis and F. Berry, ``Novel Table Lookup-Based Algorithms for
+ *     High-Performance CRC Generation'', IEEE Trans. Computers, 2008
  *
  * License: The BSD 3-Clause
  *
@@ -36,56 +45,187 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <stdexcept>
 #include "deflate.hpp"
 
 namespace deflate {
 
+struct crc32_tables {
+    std::uint32_t table[16][256];
+    crc32_tables ();
+};
+
+crc32_tables::crc32_tables ()
+{
+    for (int n = 0; n < 256; ++n) {
+        std::uint32_t c = n;
+        for (int k = 0; k < 8; ++k) {
+            if (c & 1)
+                c = 0xedb88320L ^ (c >> 1);
+            else
+                c = c >> 1;
+        }
+        table[0][n] = c;
+    }
+    /* table[k][n]: CRC of byte n followed by k zero bytes */
+    for (int k = 1; k < 16; ++k)
+        for (int n = 0; n < 256; ++n) {
+            std::uint32_t c = table[k - 1][n];
+            table[k][n] = table[0][c & 0xff] ^ (c >> 8);
+        }
+}
+
+static crc32_tables const& shared_crc32_tables ()
+{
+    static crc32_tables const tables;
+    return tables;
+}
+
 void digest_crc32::clear ()
 {
     crc = 0;
-    buf.clear ();
 }
 
 std::uint32_t digest_crc32::digest ()
 {
-    overflow ();
     return crc;
 }
 
-void digest_crc32::put (int c)
+void digest_crc32::update (std::uint8_t const* p, std::size_t n)
 {
-    if (buf.size () >= 256)
-        overflow ();
-    buf.push_back (c);
+    crc = checksum (crc, p, n);
 }
 
-void digest_crc32::fill_table ()
+static std::uint32_t crc32_slice16 (std::uint32_t c,
+    std::uint8_t const* p, std::size_t n)
 {
-    table.resize (256, 0);
-    for (int n = 0; n < 256; ++n) {
-        std::uint32_t c = n;
-        for (int k = 0; k < 8; ++k) {
-            if (c & 1)
-                c = 0xedb88320L ^ (c >> 1);
-            else
-                c = c >> 1;
-        }
-        table[n] = c;
+    std::uint32_t const (*t)[256] = shared_crc32_tables ().table;
+    for (; n >= 16; n -= 16, p += 16) {
+        std::uint32_t const x = c
+            ^ (static_cast<std::uint32_t> (p[0]))
+            ^ (static_cast<std::uint32_t> (p[1]) << 8)
+            ^ (static_cast<std::uint32_t> (p[2]) << 16)
+            ^ (static_cast<std::uint32_t> (p[3]) << 24);
+        c = t[15][x & 0xff] ^ t[14][(x >> 8) & 0xff]
+          ^ t[13][(x >> 16) & 0xff] ^ t[12][x >> 24]
+          ^ t[11][p[4]] ^ t[10][p[5]] ^ t[9][p[6]] ^ t[8][p[7]]
+          ^ t[7][p[8]] ^ t[6][p[9]] ^ t[5][p[10]] ^ t[4][p[11]]
+          ^ t[3][p[12]] ^ t[2][p[13]] ^ t[1][p[14]] ^ t[0][p[15]];
+    }
+    for (; n > 0; --n, ++p)
+        c = t[0][(c ^ *p) & 0xff] ^ (c >> 8);
+    return c;
+}
+
+static std::uint32_t crc32_combined (crc32_kernel fold, std::uint32_t crc,
+    std::uint8_t const* p, std::size_t n)
+{
+    std::uint32_t c = crc ^ 0xffffffffL;
+    if (fold != nullptr && n >= 64) {
+        std::size_t const m = n & ~static_cast<std::size_t> (15);
+        c = fold (c, p, m);
+        p += m;
+        n -= m;
     }
-    table_ok = true;
+    c = crc32_slice16 (c, p, n);
+    return c ^ 0xffffffffL;
 }
 
-void digest_crc32::overflow ()
+/* 8. Appendix: Sample CRC Code, without the table */
+static std::uint32_t crc32_reference (std::uint32_t crc,
+    std::uint8_t const* p, std::size_t n)
 {
-    if (buf.empty ())
-        return;
-    if (! table_ok)
-        fill_table ();
     std::uint32_t c = crc ^ 0xffffffffL;
-    for (int x : buf)
-        c = table[(c ^ x) & 0xff] ^ (c >> 8);
-    crc = c ^ 0xffffffffL;
-    buf.clear ();
+    for (std::size_t i = 0; i < n; ++i) {
+        c ^= p[i];
+        for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xedb88320L ^ (c >> 1) : c >> 1;
+    }
+    return c ^ 0xffffffffL;
+}
+
+static bool crc32_selftest (crc32_kernel fold)
+{
+    std::vector<std::uint8_t> data (1024 + 16);
+    std::uint32_t x = 0x12345678L;
+    for (auto& c : data) {
+        x = x * 1103515245L + 12345L;
+        c = x >> 24;
+    }
+    std::size_t const sizes[] = {
+        0, 1, 15, 16, 63, 64, 65, 79, 80, 127, 128, 129, 255, 256, 1000, 1024};
+    std::uint32_t const seeds[] = {0, 0xffffffffL, 0x2144df1cL};
+    for (std::size_t n : sizes)
+        for (std::size_t offset = 0; offset < 16; offset += 5)
+            for (std::uint32_t crc : seeds) {
+                std::uint8_t const* p = &data[offset];
+                if (crc32_combined (fold, crc, p, n) != crc32_reference (crc, p, n))
+                    return false;
+            }
+    return true;
+}
+
+struct crc32_dispatch {
+    crc32_kernel fold;
+    char const* name;
+    crc32_dispatch ();
+};
+
+crc32_dispatch::crc32_dispatch () : fold (nullptr), name ("slicing-by-16")
+{
+    if (! crc32_selftest (nullptr))
+        throw std::logic_error ("digest_crc32: slicing-by-16 self-test failed.");
+    char const* fold_name = nullptr;
+    crc32_kernel candidate = crc32_fold_kernel (fold_name);
+    if (candidate != nullptr && crc32_selftest (candidate)) {
+        fold = candidate;
+        name = fold_name;
+    }
+}
+
+static crc32_dispatch const& shared_crc32_dispatch ()
+{
+    static crc32_dispatch const dispatch;
+    return dispatch;
+}
+
+std::uint32_t digest_crc32::checksum (std::uint32_t crc,
+    std::uint8_t const* p, std::size_t n)
+{
+    return crc32_combined (shared_crc32_dispatch ().fold, crc, p, n);
+}
+
+/* a * b modulo the polynomial, in the reflected bit order: x^0 is 1 << 31 */
+static std::uint32_t crc32_multiply (std::uint32_t a, std::uint32_t b)
+{
+    std::uint32_t p = 0;
+    for (std::uint32_t m = 1UL << 31; m != 0; m >>= 1) {
+        if (a & m)
+            p ^= b;
+        b = (b & 1) ? 0xedb88320L ^ (b >> 1) : b >> 1;
+    }
+    return p;
+}
+
+std::uint32_t digest_crc32::combine (std::uint32_t crc1, std::uint32_t crc2,
+    std::uint64_t len2)
+{
+    /* x^8 by squaring x three times, then x^(8 len2) bit by bit */
+    std::uint32_t x = 1UL << 30;
+    for (int k = 0; k < 3; ++k)
+        x = crc32_multiply (x, x);
+    std::uint32_t p = 1UL << 31;
+    for (; len2 > 0; len2 >>= 1) {
+        if (len2 & 1)
+            p = crc32_multiply (x, p);
+        x = crc32_multiply (x, x);
+    }
+    return crc32_multiply (p, crc1) ^ crc2;
+}
+
+char const* digest_crc32::kernel_name ()
+{
+    return shared_crc32_dispatch ().name;
 }
 
 }// namespace deflate
@@ -0,0 +1,183 @@
+/* CRC32 folding kernels with carry-less multiplication
+ *
+ *  1. x86-64 PCLMULQDQ: fold four 128 bits lanes by 64 bytes, fold them
+ *     into one lane, and Barrett reduce it to 32 bits.
+ *  2. ARMv8 CRC32 extension: eight bytes in an instruction.
+ *  3. both take bit-inverted CRC and 64 or more bytes of multiple of 16.
+ *
+ * References:
+ *
+ *  V. Gopal et al., ``Fast CRC Computation for Generic Polynomials Using
+ *     PCLMULQDQ Instruction'', Intel White Paper, 2009
+ *  ARM, ``ARM C Language Extensions'', 9.7 CRC32 intrinsics
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "deflate.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DEFLATE_CRC32_CLMUL 1
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define DEFLATE_CRC32_ARMV8 1
+#endif
+
+namespace deflate {
+
+#if defined(DEFLATE_CRC32_CLMUL)
+
+__attribute__ ((target ("pclmul,sse4.1")))
+static std::uint32_t crc32_fold_clmul (std::uint32_t crc,
+    std::uint8_t const* p, std::size_t n)
+{
+    /* bit-reflected constants: x^(4*128+32), x^(4*128-32),
+     * x^(128+32), x^(128-32), x^64, and the Barrett constants.
+     */
+    static std::uint64_t const k1k2[2] __attribute__ ((aligned (16)))
+        = {0x0154442bd4ULL, 0x01c6e41596ULL};
+    static std::uint64_t const k3k4[2] __attribute__ ((aligned (16)))
+        = {0x01751997d0ULL, 0x00ccaa009eULL};
+    static std::uint64_t const k5k0[2] __attribute__ ((aligned (16)))
+        = {0x0163cd6124ULL, 0x0000000000ULL};
+    static std::uint64_t const poly[2] __attribute__ ((aligned (16)))
+        = {0x01db710641ULL, 0x01f7011641ULL};
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x00));
+    x2 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x10));
+    x3 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x20));
+    x4 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x30));
+    x1 = _mm_xor_si128 (x1, _mm_cvtsi32_si128 (crc));
+    x0 = _mm_load_si128 (reinterpret_cast<__m128i const*> (k1k2));
+    p += 64;
+    n -= 64;
+    /* fold four lanes in parallel */
+    for (; n >= 64; p += 64, n -= 64) {
+        x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128 (x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128 (x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128 (x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128 (x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128 (x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128 (x4, x0, 0x11);
+        x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x5),
+            _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x00)));
+        x2 = _mm_xor_si128 (_mm_xor_si128 (x2, x6),
+            _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x10)));
+        x3 = _mm_xor_si128 (_mm_xor_si128 (x3, x7),
+            _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x20)));
+        x4 = _mm_xor_si128 (_mm_xor_si128 (x4, x8),
+            _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p + 0x30)));
+    }
+    /* fold four lanes into one */
+    x0 = _mm_load_si128 (reinterpret_cast<__m128i const*> (k3k4));
+    x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+    x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x3), x5);
+    x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x4), x5);
+    /* fold the rest by 16 bytes */
+    for (; n >= 16; p += 16, n -= 16) {
+        x2 = _mm_loadu_si128 (reinterpret_cast<__m128i const*> (p));
+        x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+        x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x2), x5);
+    }
+    /* 128 bits to 64 bits */
+    x2 = _mm_clmulepi64_si128 (x1, x0, 0x10);
+    x3 = _mm_setr_epi32 (~0, 0, ~0, 0);
+    x1 = _mm_srli_si128 (x1, 8);
+    x1 = _mm_xor_si128 (x1, x2);
+    x0 = _mm_loadl_epi64 (reinterpret_cast<__m128i const*> (k5k0));
+    x2 = _mm_srli_si128 (x1, 4);
+    x1 = _mm_and_si128 (x1, x3);
+    x1 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+    x1 = _mm_xor_si128 (x1, x2);
+    /* Barrett reduction to 32 bits */
+    x0 = _mm_load_si128 (reinterpret_cast<__m128i const*> (poly));
+    x2 = _mm_and_si128 (x1, x3);
+    x2 = _mm_clmulepi64_si128 (x2, x0, 0x10);
+    x2 = _mm_and_si128 (x2, x3);
+    x2 = _mm_clmulepi64_si128 (x2, x0, 0x00);
+    x1 = _mm_xor_si128 (x1, x2);
+    return _mm_extract_epi32 (x1, 1);
+}
+
+crc32_kernel crc32_fold_kernel (char const*& name)
+{
+    __builtin_cpu_init ();
+    if (! __builtin_cpu_supports ("pclmul") || ! __builtin_cpu_supports ("sse4.1"))
+        return nullptr;
+    name = "pclmulqdq";
+    return crc32_fold_clmul;
+}
+
+#elif defined(DEFLATE_CRC32_ARMV8)
+
+__attribute__ ((target ("+crc")))
+static std::uint32_t crc32_fold_armv8 (std::uint32_t crc,
+    std::uint8_t const* p, std::size_t n)
+{
+    for (; n >= 8; p += 8, n -= 8) {
+        std::uint64_t x;
+        __builtin_memcpy (&x, p, 8);
+        crc = __crc32d (crc, x);
+    }
+    return crc;
+}
+
+crc32_kernel crc32_fold_kernel (char const*& name)
+{
+    if (! (getauxval (AT_HWCAP) & HWCAP_CRC32))
+        return nullptr;
+    name = "armv8-crc32";
+    return crc32_fold_armv8;
+}
+
+#else
+
+crc32_kernel crc32_fold_kernel (char const*& name)
+{
+    return nullptr;
+}
+
+#endif
+
+}// namespace deflate
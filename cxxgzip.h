@@ -0,0 +1,174 @@
+/* cxxgzip - C interface of the Deflate + gzip (de)compression library
+ *
+ *  1. one-shot calls compress or decompress a buffer into a buffer.
+ *  2. stream handles run over spans the caller owns, and stop when
+ *     the input runs short or the output is full.
+ *  3. no C++ exception crosses the interface: a call returns
+ *     CXXGZIP_ERROR, and cxxgzip_last_error tells the reason.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CXXGZIP_H
+#define CXXGZIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    CXXGZIP_FORMAT_GZIP = 0,
+    CXXGZIP_FORMAT_ZLIB = 2,
+    CXXGZIP_FORMAT_RAW = 3
+};
+
+enum {
+    CXXGZIP_OK = 0,
+    CXXGZIP_STREAM_END = 1,
+    CXXGZIP_NEED_INPUT = 2,
+    CXXGZIP_OUTPUT_FULL = 3,
+    CXXGZIP_ERROR = -1
+};
+
+/* flush modes of cxxgzip_deflate */
+enum {
+    CXXGZIP_NO_FLUSH = 0,
+    CXXGZIP_FINISH = 1,
+    CXXGZIP_SYNC_FLUSH = 2,
+    CXXGZIP_FULL_FLUSH = 3
+};
+
+/* compressor profiles of cxxgzip_deflate_new_profile */
+enum {
+    CXXGZIP_PROFILE_DEFAULT = 0,
+    CXXGZIP_PROFILE_SMALL = 1
+};
+
+typedef struct cxxgzip_stream cxxgzip_stream;
+
+/* the counters of a stream since cxxgzip_stats_enable. the histograms
+ * count the length codes 257-285 and the distance codes 0-29, and the
+ * times are in nanoseconds.
+ */
+typedef struct cxxgzip_stats {
+    uint64_t input;
+    uint64_t output;
+    uint64_t blocks[3];         /* stored, fixed, dynamic */
+    uint64_t bytes;
+    uint64_t literals;
+    uint64_t matches;
+    uint64_t lengths[29];
+    uint64_t distances[30];
+    uint64_t searches;
+    uint64_t candidates;
+    uint64_t max_candidates;
+    uint64_t lazy_tries;
+    uint64_t lazy_hits;
+    uint64_t match_ns;
+    uint64_t table_ns;
+    uint64_t output_ns;
+    uint64_t digest_ns;
+    uint64_t decode_ns;
+} cxxgzip_stats;
+
+typedef struct cxxgzip_block_stats {
+    int type;
+    int final;
+    uint64_t bytes;
+    uint64_t literals;
+    uint64_t matches;
+    uint64_t bits;
+    int hlit;
+    int hdist;
+    int hclen;
+    uint64_t table_bits;
+} cxxgzip_block_stats;
+
+/* the largest compressed size of srclen bytes in one call without flushes,
+ * for any profile and format.
+ */
+size_t cxxgzip_compress_bound (size_t srclen);
+
+/* one-shot: *dstlen is the capacity of dst in, and the size of the data
+ * out. they return CXXGZIP_OK, CXXGZIP_OUTPUT_FULL when dst is too small,
+ * or CXXGZIP_ERROR. they reuse a stream kept by the calling thread. the
+ * decompression takes the gzip members up to srclen, and fails on bytes
+ * after the end of a zlib or raw stream.
+ */
+int cxxgzip_compress (int format, void const* src, size_t srclen,
+    void* dst, size_t* dstlen);
+int cxxgzip_decompress (int format, void const* src, size_t srclen,
+    void* dst, size_t* dstlen);
+
+/* streaming: the calls advance the pointers and counts over the bytes
+ * taken and given, and return CXXGZIP_STREAM_END, CXXGZIP_NEED_INPUT,
+ * CXXGZIP_OUTPUT_FULL, or CXXGZIP_ERROR. a sync flush ends the block and
+ * byte-aligns the output, and a full flush also forgets the history. the
+ * inflation of gzip ends at each member, and a call with more input goes
+ * on to the next one.
+ */
+cxxgzip_stream* cxxgzip_deflate_new (int format);
+/* CXXGZIP_PROFILE_SMALL compresses in a 4 KiB window and short blocks */
+cxxgzip_stream* cxxgzip_deflate_new_profile (int format, int profile);
+cxxgzip_stream* cxxgzip_inflate_new (int format);
+/* start a new stream on the handle, keeping its buffers and tables */
+int cxxgzip_reset (cxxgzip_stream* z);
+/* with on nonzero, sync flush at the points chosen by the content of
+ * the input, so that unchanged spans compress to the same bytes.
+ */
+int cxxgzip_deflate_rsyncable (cxxgzip_stream* z, int on);
+int cxxgzip_deflate (cxxgzip_stream* z,
+    uint8_t const** next_in, size_t* avail_in,
+    uint8_t** next_out, size_t* avail_out, int flush);
+int cxxgzip_inflate (cxxgzip_stream* z,
+    uint8_t const** next_in, size_t* avail_in,
+    uint8_t** next_out, size_t* avail_out);
+void cxxgzip_free (cxxgzip_stream* z);
+
+/* statistics: enable clears the counters, and the stream keeps them
+ * until it is freed. block_stats takes the i-th block, i < nblocks.
+ */
+int cxxgzip_stats_enable (cxxgzip_stream* z);
+int cxxgzip_get_stats (cxxgzip_stream const* z, cxxgzip_stats* stats,
+    size_t* nblocks);
+int cxxgzip_get_block_stats (cxxgzip_stream const* z, size_t i,
+    cxxgzip_block_stats* block);
+
+/* the message of the last CXXGZIP_ERROR in the calling thread */
+char const* cxxgzip_last_error (void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
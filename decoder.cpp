@@ -42,222 +42,326 @@
 
 namespace deflate {
 
-/* 3.2.3. Details of block format */
-std::size_t huffman_decoder::decode (std::ostream& cout)
+/* 3.2.6. Compression with fixed Huffman codes (BTYPE=01) */
+struct fixed_huffman_tables {
+    huffman_table lit;
+    huffman_table dist;
+    fixed_huffman_tables ();
+};
+
+fixed_huffman_tables::fixed_huffman_tables ()
 {
-    for (;;) {
-        std::uint32_t fin, typ;
-        getdata (1, fin);
-        getdata (2, typ);
-        if (typ == 0)
-            decode_plain_block (cout);
-        else if (typ == 1)
-            decode_fixed_block (cout);
-        else if (typ == 2)
-            decode_custom_block (cout);
-        else
-            throw std::runtime_error ("huffman_decoder: invalid block TYP.");
-        if (fin == 1)
-            break;
-    }
-    return lzss.size ();
+    int litsize[288];
+    std::fill (litsize, litsize + 144, 8);
+    std::fill (litsize + 144, litsize + 256, 9);
+    std::fill (litsize + 256, litsize + 280, 7);
+    std::fill (litsize + 280, litsize + 288, 8);
+    lit.build (litsize, 288);
+    /* distance codes 30-31 never occur, but fill the table. */
+    int distsize[32];
+    std::fill (distsize, distsize + 32, 5);
+    dist.build (distsize, 32);
 }
 
-/* 3.2.4. Non-compressed blocks (BTYPE=00) */
-void huffman_decoder::decode_plain_block (std::ostream& cout)
+void huffman_decoder::reset ()
 {
-    std::uint32_t len = get2byte ();
-    std::uint32_t nlen = get2byte ();
-    if (len != (nlen ^ 0xffff))
-        throw std::runtime_error ("huffman_decoder: invalid non-compress block.");
-    for (std::uint32_t i = 0; i < len; ++i) {
-        int c = getbyte ();
-        lzss.decompress_literal (cout, c);
-    }
+    clear ();
+    state = BLOCK_HEADER;
+    final = false;
+    remain = 0;
+    length = distance = 0;
+    lit = dist = nullptr;
 }
 
-/* 3.2.6. Compression with fixed Huffman codes (BTYPE=01) */
-void huffman_decoder::decode_fixed_block (std::ostream& cout)
+std::size_t huffman_decoder::decode (std::ostream& cout)
 {
-    for (;;) {
-        std::uint32_t c, huff;
-        int bits;
-        decode_fixed_huffman (c, bits, huff);
-        if (c < 256)
-            lzss.decompress_literal (cout, c);
-        else if (c > 256) {
-            int n, lebits, d, c1bits, debits;
-            std::uint32_t c1, c1huff, lext, dext;
-            decode_length (c, n, lebits, lext);
-            /* Distance codes are represented by (fixed-length) 5-bit codes */
-            gethuffman (5, c1, c1bits, c1huff);
-            decode_distance (c1, d, debits, dext);
-            lzss.decompress_length_distance (cout, n, d);
-        }
-        else if (c == 256)
-            break;
-    }
+    lzss.set_sink (&cout);
+    decode ();
+    lzss.set_sink (nullptr);
+    return lzss.size ();
 }
 
-/* 3.2.7. Compression with dynamic Huffman codes (BTYPE=10) */
-void huffman_decoder::decode_custom_block (std::ostream& cout)
+/* decode without output: only the history window and the digest */
+std::size_t huffman_decoder::decode ()
 {
-    std::shared_ptr<huffman_tree> hctree;
-    std::shared_ptr<huffman_tree> littree;
-    std::shared_ptr<huffman_tree> disttree;
-    std::uint32_t hlit, hdist, hclen;
-    getdata (5, hlit);
-    getdata (5, hdist);
-    getdata (4, hclen);
-    decode_custom_block_hctable (hclen, hctree);
-    decode_custom_block_table (hlit, hdist, hctree, littree, disttree);
-    /* The actual compressed data of the block, */
-    for (;;) {
-        std::uint32_t c, huff;
-        int bits;
-        gethuffman (littree, c, bits, huff);
-        if (c < 256)
-            lzss.decompress_literal (cout, c);
-        else if (c > 256) {
-            int n, lebits, d, c1bits, debits;
-            std::uint32_t c1, c1huff, lext, dext;
-            decode_length (c, n, lebits, lext);
-            gethuffman (disttree, c1, c1bits, c1huff);
-            decode_distance (c1, d, debits, dext);
-            lzss.decompress_length_distance (cout, n, d);
-        }
-        else if (c == 256)
-            break;
-    }
+    /* the pull mode never runs short of input, and it stops only when
+     * the ring buffer is full in the hold mode: the digest and the sink
+     * take the bytes between the calls.
+     */
+    lzss.set_hold (true);
+    while (inflate () != STREAM_END)
+        lzss.sync ();
+    lzss.sync ();
+    lzss.set_hold (false);
+    return lzss.size ();
 }
 
-/* 3.2.7. Compression with dynamic Huffman codes (BTYPE=10) */
-void huffman_decoder::decode_custom_block_hctable (
-    std::uint32_t hclen, std::shared_ptr<huffman_tree>& hctree)
+/* 3.2.3. Details of block format
+ *
+ * run the states over the input in hand. it stops at the end of the
+ * final block, when the input runs short, or when the ring buffer holds
+ * the limit of the bytes which the caller has not taken yet.
+ */
+int huffman_decoder::inflate ()
 {
-    std::vector<int> hcindex{
+    static int const hcindex[19] = {
         16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-    std::vector<int> hcsize (19, 0);
-    std::vector<int> hccode;
-    /* (HCLEN + 4) x 3 bits: code lengths for the code length */
-    for (std::uint32_t i = 0; i < hclen + 4; ++i) {
+    std::size_t const window = limit;
+    stats_timer timer (stats, &stream_stats::decode_ns);
+    for (;;) {
         std::uint32_t c;
-        getdata (3, c);
-        hcsize[hcindex[i]] = c;
+        int bits, base, ebits;
+        switch (state) {
+        case BLOCK_HEADER:
+            if (! need (3))
+                return STREAM_NEED_INPUT;
+            final = peek (1);
+            c = peek (3) >> 1;
+            drop (3);
+            if (stats != nullptr && c < 3)
+                stats->blocks.push_back (block_stats {static_cast<int> (c),
+                    final, 0, 0, 0, 0, 0, 0, 0, 0});
+            if (c == 0)
+                state = STORED_HEADER;
+            else if (c == 1) {
+                make_fixed_trees ();
+                state = BLOCK_SYMBOL;
+            }
+            else if (c == 2)
+                state = TABLE_HEADER;
+            else
+                throw std::runtime_error ("huffman_decoder: invalid block TYP.");
+            break;
+        /* 3.2.4. Non-compressed blocks (BTYPE=00) */
+        case STORED_HEADER:
+            align ();
+            if (! need (32))
+                return STREAM_NEED_INPUT;
+            remain = peek (16);
+            if (remain != ((peek (32) >> 16) ^ 0xffff))
+                throw std::runtime_error ("huffman_decoder: invalid non-compress block.");
+            drop (32);
+            if (stats != nullptr)
+                stats->blocks.back ().bytes += remain;
+            state = STORED_COPY;
+            break;
+        case STORED_COPY:
+            for (; remain > 0; --remain) {
+                if (lzss.pending () >= window)
+                    return STREAM_OUTPUT_FULL;
+                if (! need (8))
+                    return STREAM_NEED_INPUT;
+                lzss.decompress_literal (peek (8));
+                drop (8);
+            }
+            state = final ? FINISHED : BLOCK_HEADER;
+            break;
+        /* 3.2.7. Compression with dynamic Huffman codes (BTYPE=10) */
+        case TABLE_HEADER:
+            if (! need (14))
+                return STREAM_NEED_INPUT;
+            hlit = peek (5);
+            hdist = peek (10) >> 5;
+            hclen = peek (14) >> 10;
+            drop (14);
+            if (stats != nullptr) {
+                block_stats& b = stats->blocks.back ();
+                b.hlit = hlit;
+                b.hdist = hdist;
+                b.hclen = hclen;
+            }
+            lengths.assign (19, 0);
+            remain = 0;
+            state = TABLE_HCLEN;
+            break;
+        /* (HCLEN + 4) x 3 bits: code lengths for the code length */
+        case TABLE_HCLEN:
+            for (; remain < hclen + 4; ++remain) {
+                if (! need (3))
+                    return STREAM_NEED_INPUT;
+                lengths[hcindex[remain]] = peek (3);
+                drop (3);
+            }
+            hctable.build (&lengths[0], 19);
+            lengths.clear ();
+            state = TABLE_LENGTHS;
+            break;
+        /* HLIT + 257 code lengths for the literal/length alphabet,
+         *            encoded using the code length Huffman code
+         * HDIST + 1  code lengths for the distance alphabet,
+         *            encoded using the code length Huffman code
+         */
+        case TABLE_LENGTHS:
+            while (lengths.size () < hlit + 257 + hdist + 1) {
+                if (! decode_symbol (&hctable, c, bits))
+                    return STREAM_NEED_INPUT;
+                if (c < 16) {
+                    drop (bits);
+                    lengths.push_back (c);
+                    continue;
+                }
+                ebits = c == 16 ? 2 : c == 17 ? 3 : 7;
+                if (! need (bits + ebits))
+                    return STREAM_NEED_INPUT;
+                drop (bits);
+                std::uint32_t m = peek (ebits);
+                drop (ebits);
+                int d = 0;
+                if (c == 16) {
+                    if (lengths.empty ())
+                        throw std::runtime_error ("huffman_decoder: invalid code lengths.");
+                    d = lengths.back ();
+                    m += 3;
+                }
+                else
+                    m += c == 17 ? 3 : 11;
+                lengths.insert (lengths.end (), m, d);
+            }
+            if (lengths.size () > hlit + 257 + hdist + 1)
+                throw std::runtime_error ("huffman_decoder: invalid code lengths.");
+            make_custom_trees ();
+            state = BLOCK_SYMBOL;
+            break;
+        /* The actual compressed data of the block */
+        case BLOCK_SYMBOL:
+            if (lzss.pending () >= window)
+                return STREAM_OUTPUT_FULL;
+            if (! decode_symbol (lit, c, bits))
+                return STREAM_NEED_INPUT;
+            if (c < 256) {
+                drop (bits);
+                lzss.decompress_literal (c);
+                if (stats != nullptr) {
+                    ++stats->blocks.back ().literals;
+                    ++stats->blocks.back ().bytes;
+                }
+                break;
+            }
+            if (c == 256) {
+                drop (bits);
+                state = final ? FINISHED : BLOCK_HEADER;
+                break;
+            }
+            length_code (c, base, ebits);
+            if (! need (bits + ebits))
+                return STREAM_NEED_INPUT;
+            drop (bits);
+            length = base + peek (ebits);
+            drop (ebits);
+            if (stats != nullptr)
+                ++stats->lengths[c - 257];
+            state = BLOCK_DISTANCE;
+            break;
+        case BLOCK_DISTANCE:
+            if (! decode_symbol (dist, c, bits))
+                return STREAM_NEED_INPUT;
+            distance_code (c, base, ebits);
+            if (! need (bits + ebits))
+                return STREAM_NEED_INPUT;
+            drop (bits);
+            distance = base + peek (ebits);
+            drop (ebits);
+            if (static_cast<std::size_t> (distance) > lzss.size ())
+                throw std::runtime_error ("huffman_decoder: invalid distance too far back.");
+            if (stats != nullptr) {
+                ++stats->distances[c];
+                ++stats->blocks.back ().matches;
+                stats->blocks.back ().bytes += length;
+            }
+            remain = length;
+            state = BLOCK_COPY;
+            break;
+        case BLOCK_COPY:
+            while (remain > 0) {
+                std::size_t const room = lzss.pending () >= window ? 0
+                    : window - lzss.pending ();
+                if (room == 0)
+                    return STREAM_OUTPUT_FULL;
+                int n = std::min (static_cast<std::size_t> (remain), room);
+                lzss.decompress_length_distance (n, distance);
+                remain -= n;
+            }
+            state = BLOCK_SYMBOL;
+            break;
+        case FINISHED:
+        default:
+            return STREAM_END;
+        }
     }
-    make_huffman_canonical (hcsize, 7, hccode);
-    make_huffman_tree (hcsize, hccode, hctree);
 }
 
-/* 3.2.7. Compression with dynamic Huffman codes (BTYPE=10) */
-void huffman_decoder::decode_custom_block_table (
-    std::uint32_t hlit, std::uint32_t hdist,
-    std::shared_ptr<huffman_tree> hctree,
-    std::shared_ptr<huffman_tree>& littree,
-    std::shared_ptr<huffman_tree>& disttree)
+/* decode a canonical code over the bits in hand, without taking them.
+ * the codes of each length are consecutive, so that a code of the length
+ * is in the table when it is less than the first one of the length plus
+ * their count.
+ */
+bool huffman_decoder::decode_symbol (huffman_table const* table,
+    std::uint32_t& c, int& bits)
 {
-    /* HLIT + 257 code lengths for the literal/length alphabet,
-     *            encoded using the code length Huffman code
-     * HDIST + 1  code lengths for the distance alphabet,
-     *            encoded using the code length Huffman code
-     */
-    std::uint32_t n = hlit + 257 + hdist + 1;
-    std::vector<int> a;
-    for (;;) {
-        std::uint32_t c, huff, m;
-        int bits, d;
-        gethuffman (hctree, c, bits, huff);
-        if (c < 16)
-            a.push_back (c);
-        else if (c == 16) {
-            getdata (2, m);
-            d = a.back ();
-            for (std::uint32_t i = 0; i < m + 3; ++i)
-                a.push_back (d);
-        }
-        else if (c == 17) {
-            getdata (3, m);
-            for (std::uint32_t i = 0; i < m + 3; ++i)
-                a.push_back (0);
-        }
-        else if (c == 18) {
-            getdata (7, m);
-            for (std::uint32_t i = 0; i < m + 11; ++i)
-                a.push_back (0);
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (bits = 1; bits <= MAXBITS; ++bits) {
+        if (! need (bits))
+            return false;
+        code |= (peek (bits) >> (bits - 1)) & 0x01;
+        int const count = table->count[bits];
+        if (code - count < first) {
+            c = table->symbol[index + (code - first)];
+            return true;
         }
-        if (a.size () >= n)
-            break;
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
     }
-    std::vector<int> litsize (a.begin (), a.begin () + hlit + 257);
-    std::vector<int> litcode;
-    std::vector<int> distsize (a.begin () + hlit + 257, a.end ());
-    std::vector<int> distcode;
-    auto litit = std::max_element (litsize.begin (), litsize.end ());
-    make_huffman_canonical (litsize, *litit, litcode);
-    make_huffman_tree (litsize, litcode, littree);
-    auto distit = std::max_element (distsize.begin (), distsize.end ());
-    make_huffman_canonical (distsize, *distit, distcode);
-    make_huffman_tree (distsize, distcode, disttree);
+    throw std::runtime_error ("huffman_decoder: invalid huffman coding.");
 }
 
 /* 3.2.6. Compression with fixed Huffman codes (BTYPE=01) */
-void huffman_decoder::decode_fixed_huffman (
-    std::uint32_t& c, int& bits, std::uint32_t& huff)
+void huffman_decoder::make_fixed_trees ()
 {
-    gethuffman (7, c, bits, huff);
-    if (huff <= 0x0b)
-        c = huff + 256;
-    else if (huff <= 0x5f) {
-        bits = 8;
-        huff = (huff << 1) | getbit ();
-        c = huff - 48;
-    }
-    else if (huff <= 0x63) {
-        bits = 8;
-        huff = (huff << 1) | getbit ();
-        c = huff + 88;
-    }
-    else {
-        bits = 9;
-        huff = (huff << 1) | getbit ();
-        huff = (huff << 1) | getbit ();
-        c = huff - 256;
-    }
+    static fixed_huffman_tables const fixed;
+    lit = &fixed.lit;
+    dist = &fixed.dist;
+}
+
+/* 3.2.7. Compression with dynamic Huffman codes (BTYPE=10) */
+void huffman_decoder::make_custom_trees ()
+{
+    littable.build (&lengths[0], hlit + 257);
+    disttable.build (&lengths[hlit + 257], hdist + 1);
+    lit = &littable;
+    dist = &disttable;
 }
 
 /* 3.2.5. Compressed blocks (length and distance codes) */
-void huffman_decoder::decode_length (
-    std::uint32_t c, int& len, int& bits, std::uint32_t& data)
+void huffman_decoder::length_code (std::uint32_t c, int& base, int& bits)
 {
-    bits = data = 0;
+    bits = 0;
     if (c <= 264)
-        len = c + 3 - 257;
+        base = c + 3 - 257;
     else if (c <= 284) {
         bits = (c - 265) / 4 + 1;
-        getdata (bits, data);
-        len = (1 << (bits + 2)) + (((c - 265) & 3) << bits) + data + 3;
+        base = (1 << (bits + 2)) + (((c - 265) & 3) << bits) + 3;
     }
     else if (c == 285)
-        len = 258;
+        base = 258;
     else
         throw std::runtime_error ("huffman_decoder: invalid length coding.");
 }
 
 /* 3.2.5. Compressed blocks (length and distance codes) */
-void huffman_decoder::decode_distance (
-    std::uint32_t c, int& dist, int& bits, std::uint32_t& data)
+void huffman_decoder::distance_code (std::uint32_t c, int& base, int& bits)
 {
-    bits = data = 0;
+    bits = 0;
     if (c <= 3)
-        dist = c + 1;
+        base = c + 1;
     else if (c <= 29) {
         bits = c / 2 - 1;
-        getdata (bits, data);
-        dist = (1 << (bits + 1)) + ((c & 1) << bits) + data + 1;
+        base = (1 << (bits + 1)) + ((c & 1) << bits) + 1;
     }
     else
         throw std::runtime_error ("huffman_decoder: invalid distance coding.");
 }
 
 }// namespace deflate
-
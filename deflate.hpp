@@ -36,13 +36,171 @@
 
 #include <string>
 #include <vector>
+#include <deque>
 #include <memory>
 #include <iostream>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
 
 namespace deflate {
 
-void gzip ();
-void gunzip ();
+enum {
+    FORMAT_GZIP = 0,
+    FORMAT_BGZF = 1,
+    FORMAT_ZLIB = 2,
+    FORMAT_RAW = 3
+};
+
+/* results of deflate_stream::compress and inflate_stream::decompress */
+enum {
+    STREAM_END = 1,
+    STREAM_NEED_INPUT = 2,
+    STREAM_OUTPUT_FULL = 3
+};
+
+/* flush modes of deflate_stream::compress */
+enum {
+    STREAM_NO_FLUSH = 0,
+    STREAM_FINISH = 1,
+    STREAM_SYNC_FLUSH = 2,
+    STREAM_FULL_FLUSH = 3
+};
+
+/* compressor profiles: the 32 KiB window, or a 4 KiB window with short
+ * blocks for a small footprint. blocks of at most SMALLBLOCK codes take
+ * the fast heuristic Huffman lengths instead of the optimal ones.
+ */
+enum {
+    PROFILE_DEFAULT = 0,
+    PROFILE_SMALL = 1,
+    SMALLBLOCK = 4096
+};
+
+/* when the pipeline flushes: every bytes of input, and when the input
+ * has been pending for milliseconds. 0 disables each. rsyncable makes
+ * the stream sync flush at the points chosen by the input content.
+ */
+struct flush_policy {
+    flush_policy ()
+        : mode (STREAM_SYNC_FLUSH), bytes (0), milliseconds (0),
+          rsyncable (false) {}
+    int mode;
+    std::size_t bytes;
+    int milliseconds;
+    bool rsyncable;
+};
+
+/* what --grep searches for: the fixed strings, or the regular expressions
+ * of ECMAScript with regex, either of which a line contains. offsets puts
+ * the offset of each line in the decompressed stream before it, and
+ * max_count stops a file after the lines, 0 for no limit.
+ */
+struct grep_options {
+    grep_options ()
+        : patterns (), regex (false), offsets (false), max_count (0) {}
+    std::vector<std::string> patterns;
+    bool regex;
+    bool offsets;
+    std::uint64_t max_count;
+};
+
+/* a block in the order of the stream. the decoder leaves bits 0. */
+struct block_stats {
+    int type;                   /* BTYPE: 0 stored, 1 fixed, 2 dynamic */
+    bool final;
+    std::uint64_t bytes;        /* uncompressed */
+    std::uint64_t literals;
+    std::uint64_t matches;
+    std::uint64_t bits;         /* the estimate of the encoder */
+    int hlit, hdist, hclen;     /* the sizes of the dynamic tables */
+    std::uint64_t table_bits;   /* the dynamic table header */
+};
+
+/* the counters of a stream, kept while they are set to the stream.
+ * the histograms count the length codes 257-285 and the distance codes
+ * 0-29, and the times of the stages are in nanoseconds.
+ */
+struct stream_stats {
+    stream_stats () { clear (); }
+    void clear ();
+    void merge (stream_stats const& s);
+    block_stats total () const;
+    void report (std::ostream& out) const;
+    std::uint64_t input;
+    std::uint64_t output;
+    std::uint64_t lengths[29];
+    std::uint64_t distances[30];
+    std::uint64_t searches;         /* calls of longest_match */
+    std::uint64_t candidates;       /* chain entries walked */
+    std::uint64_t max_candidates;
+    std::uint64_t lazy_tries;
+    std::uint64_t lazy_hits;        /* the match at the next byte won */
+    std::uint64_t match_ns;
+    std::uint64_t table_ns;
+    std::uint64_t output_ns;
+    std::uint64_t digest_ns;
+    std::uint64_t decode_ns;
+    std::vector<block_stats> blocks;
+};
+
+/* add the time of the scope to a counter of the stats, if any */
+class stats_timer {
+public:
+    stats_timer (stream_stats* s, std::uint64_t stream_stats::* c)
+        : stats (s), counter (c)
+    {
+        if (stats != nullptr)
+            start = std::chrono::steady_clock::now ();
+    }
+    ~stats_timer ()
+    {
+        if (stats != nullptr)
+            stats->*counter += std::chrono::duration_cast<std::chrono::nanoseconds> (
+                std::chrono::steady_clock::now () - start).count ();
+    }
+private:
+    stream_stats* stats;
+    std::uint64_t stream_stats::* counter;
+    std::chrono::steady_clock::time_point start;
+};
+
+void gzip (int format = FORMAT_GZIP, int nthreads = 1,
+    flush_policy const& policy = flush_policy (),
+    stream_stats* stats = nullptr, int profile = PROFILE_DEFAULT);
+void gzip_pipeline (int format, int infd, int outfd,
+    flush_policy const& policy = flush_policy (),
+    stream_stats* stats = nullptr, int profile = PROFILE_DEFAULT,
+    int nthreads = 1);
+void gunzip (int format = FORMAT_GZIP, int nthreads = 1,
+    stream_stats* stats = nullptr);
+int gztest (std::vector<std::string> const& paths, int format,
+    int nthreads, std::ostream& report);
+int gzlist (std::vector<std::string> const& paths, int nthreads,
+    std::ostream& report);
+int gzgrep (std::vector<std::string> const& paths, int format,
+    grep_options const& options, std::ostream& out, std::ostream& report);
+void bgzf_seek (std::uint64_t voffset, int nthreads = 1);
+void gzip_file (std::string const& path,
+    int format = FORMAT_GZIP, int nthreads = 1);
+void gunzip_file (std::string const& path,
+    int format = FORMAT_GZIP, int nthreads = 1);
+
+/* the longest code in Deflate */
+enum {MAXBITS = 15};
+
+/* canonical Huffman decoding table: the number of the codes for each
+ * length, and the symbols in order of their codes.
+ */
+struct huffman_table {
+    std::uint16_t count[MAXBITS + 1];
+    std::uint16_t symbol[288];
+    void build (int const* lengths, int n);
+};
 
 struct huffman_tree {
     std::shared_ptr<huffman_tree> zero, one;
@@ -52,6 +210,8 @@ struct huffman_tree {
 
 void make_huffman_limitedsize (std::vector<int> const& counts,
     int const nhfsize, int const limit, std::vector<int>& hfsize);
+void make_huffman_fastsize (std::vector<int> const& counts,
+    int const nhfsize, int const limit, std::vector<int>& hfsize);
 void make_huffman_canonical (std::vector<int> const& hfsize,
     int const limit, std::vector<int>& hfcode);
 void make_huffman_tree (std::vector<int> const& hfsize,
@@ -64,42 +224,94 @@ public:
     virtual ~digest_base () {}
     virtual void clear () {}
     virtual std::uint32_t digest () { return 0; }
-    virtual void put (int c) {}
+    virtual void update (std::uint8_t const* p, std::size_t n) {}
 };
 
+typedef std::uint32_t (*crc32_kernel) (std::uint32_t c,
+    std::uint8_t const* p, std::size_t n);
+crc32_kernel crc32_fold_kernel (char const*& name);
+
 class digest_crc32 : public digest_base {
 public:
-    digest_crc32 () : crc (0), buf (), table (), table_ok (false) {}
+    digest_crc32 () : crc (0) {}
     void clear ();
     std::uint32_t digest ();
-    void put (int c);
+    void update (std::uint8_t const* p, std::size_t n);
+    static std::uint32_t checksum (std::uint32_t crc,
+        std::uint8_t const* p, std::size_t n);
+    static std::uint32_t combine (std::uint32_t crc1, std::uint32_t crc2,
+        std::uint64_t len2);
+    static char const* kernel_name ();
 private:
     std::uint32_t crc;
-    std::vector<int> buf;
-    std::vector<std::uint32_t> table;
-    bool table_ok;
-    void fill_table ();
-    void overflow ();
+};
+
+enum {
+    ADLER32_BASE = 65521,
+    ADLER32_NMAX = 5552
+};
+
+typedef std::uint32_t (*adler32_kernel) (std::uint32_t adler,
+    std::uint8_t const* p, std::size_t n);
+adler32_kernel adler32_vector_kernel (char const*& name);
+
+class digest_adler32 : public digest_base {
+public:
+    digest_adler32 () : adler (1) {}
+    void clear ();
+    std::uint32_t digest ();
+    void update (std::uint8_t const* p, std::size_t n);
+    static std::uint32_t checksum (std::uint32_t adler,
+        std::uint8_t const* p, std::size_t n);
+    static char const* kernel_name ();
+private:
+    std::uint32_t adler;
 };
 
 class bitoutput {
 public:
-    bitoutput (std::ostream& acout) : cout (acout), bitbuf (0), bitpos (0) {}
+    bitoutput (std::ostream& acout)
+        : cout (&acout), obuf (), ohead (0), bitbuf (0), bitpos (0) {}
+    bitoutput ()
+        : cout (nullptr), obuf (), ohead (0), bitbuf (0), bitpos (0) {}
     void puthuffman (int const n, std::uint32_t const huff);
     void putdata (int const n, std::uint32_t const data);
     void put4byte (std::uint32_t const data);
+    void put4byte_bigendian (std::uint32_t const data);
     void put2byte (std::uint32_t const data);
     void putbyte (std::uint32_t const data);
     void putbit (std::uint32_t const data);
+    void align ();
+    void flush ();
+    void discard () { obuf.clear (); ohead = 0; bitbuf = 0; bitpos = 0; }
+    std::size_t pending () const { return obuf.size () - ohead; }
+    std::size_t drain (std::uint8_t* p, std::size_t n);
 private:
-    std::ostream& cout;
+    enum {OBUFSIZE = 65536};
+    std::ostream* cout;
+    std::string obuf;
+    std::size_t ohead;
     std::uint32_t bitbuf;
     int bitpos;
+    void putraw (std::uint32_t const data);
 };
 
 class bitinput {
 public:
-    bitinput (std::istream& acin) : cin (acin), bitbuf (0), bitpos (8) {}
+    bitinput (std::istream& acin)
+        : cin (&acin), next (nullptr), end (nullptr), bitbuf (0), bitcnt (0) {}
+    bitinput ()
+        : cin (nullptr), next (nullptr), end (nullptr), bitbuf (0), bitcnt (0) {}
+    void feed (std::uint8_t const* p, std::size_t n) { next = p; end = p + n; }
+    std::size_t avail () const { return end - next; }
+    bool need (int const n);
+    std::uint32_t peek (int const n) const
+    {
+        return bitbuf & ((static_cast<std::uint64_t> (1) << n) - 1);
+    }
+    void drop (int const n) { bitbuf >>= n; bitcnt -= n; }
+    void align () { drop (bitcnt & 7); }
+    void clear () { bitbuf = 0; bitcnt = 0; }
     void gethuffman (int const n,
         std::uint32_t& c, int& bits, std::uint32_t& huff);
     void gethuffman (std::shared_ptr<huffman_tree> tree,
@@ -107,36 +319,83 @@ public:
     void getdata (int const n, std::uint32_t& c);
     void getasciiz (std::string& s);
     std::uint32_t get4byte ();
+    std::uint32_t get4byte_bigendian ();
     std::uint32_t get2byte ();
     std::uint32_t getbyte ();
     std::uint32_t getbit ();
 private:
-    std::istream& cin;
-    std::uint32_t bitbuf;
-    int bitpos;
+    std::istream* cin;
+    std::uint8_t const* next;
+    std::uint8_t const* end;
+    std::uint64_t bitbuf;
+    int bitcnt;
+    void require (int const n);
 };
 
+/* the symbols of a block and their counts for the block type selection */
+struct token_block {
+    token_block ()
+        : codelist (), litcounts (286, 0), distcounts (30, 0),
+          stat_extra (0), stat_lendist (0), stat_fixed (0), bfinal (1) {}
+    std::vector<int> codelist;
+    std::vector<int> litcounts;
+    std::vector<int> distcounts;
+    int stat_extra;
+    int stat_lendist;
+    int stat_fixed;
+    int bfinal;
+};
+
+/* the match finder fills a token block while the other is encoded: in
+ * place by end_block, or on the worker thread with set_async, so that
+ * the output bits are the same. the bit output belongs to the worker
+ * until wait returns.
+ */
 class huffman_encoder : public bitoutput {
 public:
     huffman_encoder (std::ostream& acout)
-        : bitoutput (acout), hclist (), codelist (),
-          hccounts (19, 0), litcounts (286, 0), distcounts (30, 0),
-          stat_extra (0), stat_lendist (0), stat_fixed (0) {}
+        : bitoutput (acout), hclist (), hccounts (19, 0),
+          fill (&blocks[0]), coded (&blocks[1]), stats (nullptr),
+          fast (false), busy (false), quit (false) {}
+    huffman_encoder ()
+        : bitoutput (), hclist (), hccounts (19, 0),
+          fill (&blocks[0]), coded (&blocks[1]), stats (nullptr),
+          fast (false), busy (false), quit (false) {}
+    ~huffman_encoder ();
     void start_block ();
     void put_literal (int code);
     void put_length_distance (int len, int dist);
-    void end_block ();
+    void end_block (bool last = true);
+    void put_empty_stored_block ();
+    void set_stats (stream_stats* s) { stats = s; }
+    void set_fast_tables (bool on) { fast = on; }
+    void reserve (std::size_t codes);
+    void set_async (bool on);
+    void wait ();
+    bool ready () { std::lock_guard<std::mutex> lock (mutex); return ! busy; }
+    std::size_t codes () const { return fill->codelist.size (); }
 private:
     enum {LIMIT = 15};
     std::vector<int> hclist;
-    std::vector<int> codelist;
     std::vector<int> hccounts;
-    std::vector<int> litcounts;
-    std::vector<int> distcounts;
-    int stat_extra;
-    int stat_lendist;
-    int stat_fixed;
+    token_block blocks[2];
+    token_block* fill;
+    token_block* coded;
+    stream_stats* stats;
+    bool fast;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool busy;
+    bool quit;
+    std::exception_ptr error;
+    void work ();
+    /* the scratch of encode_block kept over the blocks */
+    std::vector<int> hcsize, litsize, distsize;
+    std::vector<int> hchuff, lithuff, disthuff;
+    std::vector<int> rlcode, rlcount;
     void encode_block ();
+    void record_block (int type, int bits);
     void encode_plain_block ();
     void encode_fixed_block ();
     void encode_custom_block (std::vector<int> const& hcsize,
@@ -157,60 +416,383 @@ private:
     void runlength_zeros (int n);
 };
 
-class lzss_compression {
+class thread_pool {
+public:
+    explicit thread_pool (int nthreads);
+    ~thread_pool ();
+    void submit (std::function<void()> const& task);
+    void wait ();
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::atomic<int> queued;
+    std::atomic<unsigned> next;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable task_done;
+    int pending;
+    bool stopping;
+    std::exception_ptr error;
+    bool take (int index, std::function<void()>& task);
+    void run (int index);
+};
+
+/* bounded lock-free queue for a single producer and a single consumer.
+ * push and pop spin, then yield, then sleep while the queue is full or
+ * empty.
+ */
+template <typename T>
+class spsc_queue {
+public:
+    explicit spsc_queue (std::size_t capacity)
+        : ring (capacity + 1), head (0), tail (0) {}
+    bool try_push (T const& x)
+    {
+        std::size_t const t = tail.load (std::memory_order_relaxed);
+        std::size_t const n = (t + 1) % ring.size ();
+        if (n == head.load (std::memory_order_acquire))
+            return false;
+        ring[t] = x;
+        tail.store (n, std::memory_order_release);
+        return true;
+    }
+    bool try_pop (T& x)
+    {
+        std::size_t const h = head.load (std::memory_order_relaxed);
+        if (h == tail.load (std::memory_order_acquire))
+            return false;
+        x = ring[h];
+        head.store ((h + 1) % ring.size (), std::memory_order_release);
+        return true;
+    }
+    void push (T const& x)
+    {
+        for (int i = 0; ! try_push (x); ++i)
+            backoff (i);
+    }
+    T pop ()
+    {
+        T x;
+        for (int i = 0; ! try_pop (x); ++i)
+            backoff (i);
+        return x;
+    }
+    bool pop_until (T& x, std::chrono::steady_clock::time_point deadline)
+    {
+        for (int i = 0; ! try_pop (x); ++i) {
+            if (std::chrono::steady_clock::now () >= deadline)
+                return false;
+            backoff (i);
+        }
+        return true;
+    }
+private:
+    std::vector<T> ring;
+    alignas (64) std::atomic<std::size_t> head;
+    alignas (64) std::atomic<std::size_t> tail;
+    static void backoff (int const i)
+    {
+        if (i < 64)
+            std::this_thread::yield ();
+        else
+            std::this_thread::sleep_for (std::chrono::microseconds (50));
+    }
+};
+
+/* a link of the hash chains: the distance back to the previous position
+ * of the same hash, 0 at the end, and a tag of the bytes at the position
+ * of the link, which rejects most candidates without a look into the
+ * window.
+ */
+struct chain_link {
+    std::uint16_t dist;
+    std::uint16_t tag;
+};
+
+/* the window of 2^WBITS bytes and the hash table of 2^HBITS chains are
+ * fixed at the compile time, so that the loops are specialized for them.
+ * a block ends within BLOCKLIMIT entries of the code list, or only at
+ * a flush and at the end with 0.
+ * the instances are in lzss.cpp.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+class lzss_window {
 public:
     enum {
         THRESHOLD = 3,
-        WINSIZE = 32768,
+        WINBITS = WBITS,
+        WINSIZE = 1 << WBITS,
         DATASIZE = 258,
-        BUFSIZE = 65536,
-        HASHSIZE = 8192,
-        HASHLOG2 = 13
+        BUFSIZE = 2 << WBITS,
+        HASHSIZE = 1 << HBITS,
+        HASHLOG2 = HBITS,
+        REBASE = 1 << 30,
+        BLOCKCODES = BLOCKLIMIT,
+        KEYBITS = 24 - HBITS
     };
-    lzss_compression (std::shared_ptr<digest_base> const& d)
-        : buf (BUFSIZE, 0), idx (BUFSIZE, -WINSIZE),
-          top (HASHSIZE, -WINSIZE),
-          digest (d),
-          msize (0) {}
-    std::size_t size () const { return msize; }
-    void decompress_literal (std::ostream& cout, int const c);
-    void decompress_length_distance (std::ostream& cout,
-        int const n, int const d);
+    static_assert (WBITS <= 15 && HBITS >= 8,
+        "lzss_window: the chains take 16 bits.");
+    lzss_window (std::shared_ptr<digest_base> const& d)
+        : buf (BUFSIZE, 0), idx (), top (), hbase (0),
+          digest (d), sink (nullptr), hold (false), msize (0), mbase (0), msync (0), mcur (0), mlimit (0),
+          stats (nullptr) {}
+    std::size_t size () const { return msize - mbase; }
+    void reset ();
+    void set_sink (std::ostream* cout) { sink = cout; }
+    void set_hold (bool const h) { hold = h; }
+    void set_stats (stream_stats* s) { stats = s; }
+    void sync ();
+    std::size_t pending () const { return msize - msync; }
+    std::size_t held (std::uint8_t const*& p) const;
+    void release (std::size_t n);
+    std::size_t drain (std::uint8_t* p, std::size_t n);
+    void decompress_literal (int const c);
+    void decompress_length_distance (int const n, int const d);
+    void compress_begin (huffman_encoder& huffman);
+    std::size_t compress_feed (std::uint8_t const* p, std::size_t n,
+        huffman_encoder& huffman);
+    void compress_flush (huffman_encoder& huffman, bool full);
+    int compress_finish (huffman_encoder& huffman);
     int compress (std::istream& cin, huffman_encoder& huffman);
 private:
     std::vector<uint8_t> buf;
-    std::vector<int> idx;
-    std::vector<int> top;
+    std::vector<chain_link> idx;    /* the chains, made by compress_begin */
+    std::vector<std::uint16_t> top; /* the heads over hbase, 0 for none */
+    int hbase;
     std::shared_ptr<digest_base> digest;
+    std::ostream* sink;
+    bool hold;
     int msize;
+    int mbase;          /* the position where the stream started */
+    int msync;
+    int mcur;
+    int mlimit;
+    stream_stats* stats;
     void put (int const c);
+    void compress_step (huffman_encoder& huffman);
+    void rebase ();
     int index_3gram (int const cur);
     bool longest_match (int const cur, int& len, int& dist);
 };
 
+/* 32 KiB window with 8K chains and blocks of 128K codes, and 4 KiB with
+ * 1K for a small footprint
+ */
+typedef lzss_window<15, 13, 131072> lzss_compression;
+typedef lzss_window<12, 10, 2048> lzss_compression_small;
+
 class huffman_decoder : public bitinput {
 public:
     huffman_decoder (std::istream& acin, lzss_compression& alzss)
-        : bitinput (acin), lzss (alzss) {}
+        : bitinput (acin), lzss (alzss), stats (nullptr),
+          limit (lzss_compression::BUFSIZE) { reset (); }
+    huffman_decoder (lzss_compression& alzss)
+        : bitinput (), lzss (alzss), stats (nullptr),
+          limit (lzss_compression::BUFSIZE) { reset (); }
+    void reset ();
+    void set_stats (stream_stats* s) { stats = s; lzss.set_stats (s); }
+    /* stop when the bytes not taken reach n, at most BUFSIZE */
+    void set_limit (std::size_t n) { limit = n; }
     std::size_t decode (std::ostream& cout);
-    void decode_plain_block (std::ostream& cout);
-    void decode_fixed_block (std::ostream& cout);
-    void decode_custom_block (std::ostream& cout);
-    void decode_custom_block_hctable (std::uint32_t hclen,
-        std::shared_ptr<huffman_tree>& hctree);
-    void decode_custom_block_table (std::uint32_t hlit, std::uint32_t hdist,
-        std::shared_ptr<huffman_tree> hctree,
-        std::shared_ptr<huffman_tree>& littree,
-        std::shared_ptr<huffman_tree>& disttree);
-    void decode_fixed_huffman (std::uint32_t& c,
-        int& bits, std::uint32_t& huff);
-    void decode_length (std::uint32_t c,
-        int& len, int& bits, std::uint32_t& data);
-    void decode_distance (std::uint32_t c,
-        int& dist, int& bits, std::uint32_t& data);
+    std::size_t decode ();
+    int inflate ();
 private:
+    enum {
+        BLOCK_HEADER, STORED_HEADER, STORED_COPY,
+        TABLE_HEADER, TABLE_HCLEN, TABLE_LENGTHS,
+        BLOCK_SYMBOL, BLOCK_DISTANCE, BLOCK_COPY, FINISHED
+    };
     lzss_compression& lzss;
+    stream_stats* stats;
+    std::size_t limit;
+    int state;
+    bool final;
+    std::uint32_t remain;
+    int length;
+    int distance;
+    std::uint32_t hlit;
+    std::uint32_t hdist;
+    std::uint32_t hclen;
+    std::vector<int> lengths;
+    huffman_table hctable;
+    huffman_table littable;
+    huffman_table disttable;
+    huffman_table const* lit;
+    huffman_table const* dist;
+    bool decode_symbol (huffman_table const* table,
+        std::uint32_t& c, int& bits);
+    void make_fixed_trees ();
+    void make_custom_trees ();
+    void length_code (std::uint32_t c, int& base, int& bits);
+    void distance_code (std::uint32_t c, int& base, int& bits);
+};
+
+/* the compressor behind a profile, chosen at the run time */
+class deflate_stream_base {
+public:
+    virtual ~deflate_stream_base () {}
+    virtual void reset () = 0;
+    virtual void set_stats (stream_stats* s) = 0;
+    virtual void set_rsyncable (bool on) = 0;
+    virtual void set_encoder_thread (bool on) = 0;
+    virtual int compress (std::uint8_t const*& next_in, std::size_t& avail_in,
+        std::uint8_t*& next_out, std::size_t& avail_out, int flush) = 0;
 };
 
+template <class LZSS>
+class basic_deflate_stream : public deflate_stream_base {
+public:
+    explicit basic_deflate_stream (int aformat = FORMAT_GZIP);
+    void reset ();
+    void set_stats (stream_stats* s);
+    void set_rsyncable (bool on) { rsyncable = on; }
+    void set_encoder_thread (bool on) { encoder.set_async (on); }
+    int compress (std::uint8_t const*& next_in, std::size_t& avail_in,
+        std::uint8_t*& next_out, std::size_t& avail_out, int flush);
+private:
+    enum {
+        RSYNCBITS = 13,         /* 8 KiB between the points on average */
+        RSYNCMIN = 1024         /* the shortest span between the points */
+    };
+    int format;
+    bool finished;
+    bool flushed;
+    bool rsyncable;
+    std::uint64_t rolling;      /* the gear hash of the input */
+    std::size_t unsynced;       /* bytes since the last point */
+    stream_stats* stats;
+    std::shared_ptr<digest_base> digest;
+    LZSS lzss;
+    huffman_encoder encoder;
+    std::size_t rsync_scan (std::uint8_t const* p, std::size_t n);
+};
+
+typedef basic_deflate_stream<lzss_compression> deflate_stream;
+typedef basic_deflate_stream<lzss_compression_small> small_deflate_stream;
+
+struct gzip_header {
+    std::uint32_t flg;
+    std::uint32_t mtime;
+    std::uint32_t xfl;
+    std::uint32_t os;
+    std::string extra;
+    std::string name;
+    std::string comment;
+    int bsize;          /* BGZF BSIZE subfield, or -1 */
+    std::int64_t msize; /* SP subfield, the size of a split member, or -1 */
+    std::size_t length; /* header size in bytes */
+};
+
+class inflate_stream {
+public:
+    explicit inflate_stream (int aformat = FORMAT_GZIP);
+    void reset ();
+    void set_stats (stream_stats* s);
+    int decompress (std::uint8_t const*& next_in, std::size_t& avail_in,
+        std::uint8_t*& next_out, std::size_t& avail_out);
+    int decompress_span (std::uint8_t const*& next_in, std::size_t& avail_in,
+        std::uint8_t const*& span, std::size_t& size);
+    void set_chunk (std::size_t n);
+    gzip_header const& header () const { return mheader; }
+private:
+    enum {HEADER, BODY, TRAILER, END};
+    int format;
+    int state;
+    std::size_t taken;  /* the span given by the last decompress_span */
+    stream_stats* stats;
+    std::string hbuf;
+    gzip_header mheader;
+    std::shared_ptr<digest_base> digest;
+    lzss_compression lzss;
+    huffman_decoder decoder;
+    int inflate (std::uint8_t const*& next_in, std::size_t& avail_in,
+        std::uint8_t*& next_out, std::size_t& avail_out);
+    void check_trailer ();
+};
+
+/* the pull mode over an input stream or a span of the compressed data.
+ * next_chunk gives the decompressed bytes in place in the ring buffer of
+ * the decoder, valid until the next call, and 0 at the end. it decodes
+ * at most chunk bytes ahead of the caller.
+ */
+class inflate_reader {
+public:
+    explicit inflate_reader (std::istream& acin, int aformat = FORMAT_GZIP,
+        std::size_t chunk = 16384);
+    inflate_reader (std::uint8_t const* p, std::size_t n,
+        int aformat = FORMAT_GZIP, std::size_t chunk = 16384);
+    std::size_t next_chunk (std::uint8_t const*& p);
+    gzip_header const& header () const { return stream.header (); }
+    void set_stats (stream_stats* s) { stream.set_stats (s); }
+private:
+    enum {IBUFSIZE = 65536};
+    std::istream* cin;
+    int format;
+    inflate_stream stream;
+    std::vector<std::uint8_t> ibuf;
+    std::uint8_t const* next_in;
+    std::size_t avail_in;
+    bool refill ();
+};
+
+/* read-only memory mapping of a whole file */
+class mapped_file {
+public:
+    explicit mapped_file (std::string const& path);
+    ~mapped_file ();
+    mapped_file (mapped_file const&) = delete;
+    mapped_file& operator= (mapped_file const&) = delete;
+    std::uint8_t const* data () const { return addr; }
+    std::size_t size () const { return len; }
+private:
+    std::uint8_t* addr;
+    std::size_t len;
+};
+
+std::shared_ptr<digest_base> make_digest (int format);
+deflate_stream& thread_deflate_stream (int format);
+std::unique_ptr<deflate_stream_base> make_deflate_stream (int format,
+    int profile = PROFILE_DEFAULT);
+inflate_stream& thread_inflate_stream (int format);
+void compress_span (int format, std::uint8_t const* p, std::size_t n,
+    std::function<void(std::uint8_t const*, std::size_t)> const& put);
+std::string file_suffix (int format);
+/* Deflate expands a byte at most 1032 times: a 258 byte match in 2 bits */
+enum {MAXRATIO = 1032};
+std::size_t isize_hint (std::uint8_t const* p, std::size_t n);
+void write_parts (std::string const& path,
+    std::vector<std::string> const& parts);
+void collect_files (std::string const& path, bool recursive,
+    bool decompress, int format, std::vector<std::string>& files);
+/* a large gzip file is cut into members of SPLITSIZE input bytes, each
+ * with a header of SPLIT_HEADERSIZE bytes telling the member size.
+ */
+enum {SPLITSIZE = 8 * 1024 * 1024, SPLIT_HEADERSIZE = 20};
+int gzip_batch (std::vector<std::string> const& paths, bool decompress,
+    int format, int nthreads, std::ostream& report);
+int gzip_batch_uring (std::vector<std::string> const& paths,
+    bool decompress, int format, int nthreads, std::ostream& report);
+void put_gzip_header (bitoutput& output);
+void put_split_header (std::uint8_t* p, std::uint32_t msize);
+std::size_t parse_gzip_header (std::string const& s, gzip_header& header);
+void read_gzip_header (bitinput& input, gzip_header& header);
+void gunzip_stream (std::istream& cin, std::ostream* cout,
+    int format, int nthreads, stream_stats* stats = nullptr);
+std::size_t gunzip_member (std::istream& cin, std::ostream* cout,
+    stream_stats* stats = nullptr);
+void check_zlib_header (std::uint32_t const cmf, std::uint32_t const flg);
+void zlib_decompress (std::istream& cin, std::ostream* cout,
+    stream_stats* stats = nullptr);
+void raw_decompress (std::istream& cin, std::ostream* cout,
+    stream_stats* stats = nullptr);
+void bgzf_compress (std::istream& cin, std::ostream& cout, int nthreads);
+void bgzf_decompress (std::istream& cin, std::ostream& cout,
+    gzip_header const& first, std::uint32_t skip, int nthreads,
+    stream_stats* stats = nullptr);
+
 }// namespace deflate
 #endif
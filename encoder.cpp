@@ -36,18 +36,29 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include "deflate.hpp"
 
 namespace deflate {
 
+huffman_encoder::~huffman_encoder ()
+{
+    set_async (false);
+}
+
 void huffman_encoder::start_block ()
 {
-    hclist.clear ();
-    codelist.clear ();
-    std::fill (hccounts.begin (), hccounts.end (), 0);
-    std::fill (litcounts.begin (), litcounts.end (), 0);
-    std::fill (distcounts.begin (), distcounts.end (), 0);
-    stat_extra = stat_lendist = stat_fixed = 0;
+    fill->codelist.clear ();
+    std::fill (fill->litcounts.begin (), fill->litcounts.end (), 0);
+    std::fill (fill->distcounts.begin (), fill->distcounts.end (), 0);
+    fill->stat_extra = fill->stat_lendist = fill->stat_fixed = 0;
+}
+
+/* make the code lists of the blocks at the size of the block limit */
+void huffman_encoder::reserve (std::size_t const codes)
+{
+    blocks[0].codelist.reserve (codes);
+    blocks[1].codelist.reserve (codes);
 }
 
 void huffman_encoder::put_literal (int code)
@@ -55,13 +66,13 @@ void huffman_encoder::put_literal (int code)
     int bits;
     std::uint32_t huff;
     /* code in 0 .. 255 */
-    codelist.push_back (code);
+    fill->codelist.push_back (code);
     /* update statistics */
     /* for Huffman coding */
-    ++litcounts[code];
+    ++fill->litcounts[code];
     /* for block type selection */
     fixed_huffman_code (code, bits, huff);
-    stat_fixed += bits;
+    fill->stat_fixed += bits;
 }
 
 void huffman_encoder::put_length_distance (int len, int dist)
@@ -69,65 +80,204 @@ void huffman_encoder::put_length_distance (int len, int dist)
     int lencode, lenbits, lexbits, distcode, dexbits;
     std::uint32_t lenhuff, lextra, dextra;
     /* 257 is temporal alphabet for <length, distance> */
-    codelist.push_back (257);
-    codelist.push_back (len);
-    codelist.push_back (dist);
+    fill->codelist.push_back (257);
+    fill->codelist.push_back (len);
+    fill->codelist.push_back (dist);
     /* update statistics */
     encode_length (len, lencode, lexbits, lextra);
     encode_distance (dist, distcode, dexbits, dextra);
     /* for Huffman coding */
-    ++litcounts[lencode];       
-    ++distcounts[distcode];
+    ++fill->litcounts[lencode];
+    ++fill->distcounts[distcode];
     /* for block type selection */
     fixed_huffman_code (lencode, lenbits, lenhuff);
-    stat_fixed += lenbits + lexbits + 5 + dexbits;  
-    stat_extra += lexbits + dexbits;
-    ++stat_lendist;
+    fill->stat_fixed += lenbits + lexbits + 5 + dexbits;
+    fill->stat_extra += lexbits + dexbits;
+    ++fill->stat_lendist;
 }
 
-void huffman_encoder::end_block ()
+/* the filled block changes places with the coded one, which the worker
+ * has done with. the worker encodes it while the caller fills the next,
+ * or the caller encodes it in place without the worker.
+ */
+void huffman_encoder::end_block (bool last)
 {
+    fill->bfinal = last ? 1 : 0;
     /* the value 256 indicates end-of-block */
-    codelist.push_back (256);
-    ++litcounts[256];
-    stat_fixed += 8;
-    encode_block ();
+    fill->codelist.push_back (256);
+    ++fill->litcounts[256];
+    fill->stat_fixed += 8;
+    wait ();
+    std::swap (fill, coded);
+    if (! worker.joinable ()) {
+        encode_block ();
+        return;
+    }
+    std::lock_guard<std::mutex> lock (mutex);
+    busy = true;
+    cv.notify_all ();
+}
+
+/* encode the blocks on a thread of the encoder, or stop it with false */
+void huffman_encoder::set_async (bool const on)
+{
+    if (on == worker.joinable ())
+        return;
+    if (on) {
+        quit = false;
+        worker = std::thread (&huffman_encoder::work, this);
+        return;
+    }
+    wait ();
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        quit = true;
+        cv.notify_all ();
+    }
+    worker.join ();
+}
+
+/* wait for the block in the worker, which owns the bit output until
+ * then, and throw its error if any.
+ */
+void huffman_encoder::wait ()
+{
+    if (! worker.joinable ())
+        return;
+    std::unique_lock<std::mutex> lock (mutex);
+    cv.wait (lock, [this]{ return ! busy; });
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception (e);
+    }
+}
+
+void huffman_encoder::work ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    for (;;) {
+        cv.wait (lock, [this]{ return busy || quit; });
+        if (quit)
+            return;
+        lock.unlock ();
+        try {
+            encode_block ();
+        }
+        catch (...) {
+            error = std::current_exception ();
+        }
+        lock.lock ();
+        busy = false;
+        cv.notify_all ();
+    }
 }
 
 void huffman_encoder::encode_block ()
 {
-    std::vector<int> hcsize;
-    std::vector<int> litsize;
-    std::vector<int> distsize;
-    if (codelist.size () == 1) {
+    hclist.clear ();
+    std::fill (hccounts.begin (), hccounts.end (), 0);
+    if (coded->codelist.size () == 1) {
+        stats_timer timer (stats, &stream_stats::output_ns);
         encode_fixed_block ();      /* empty block */
+        if (stats != nullptr)
+            record_block (1, coded->stat_fixed);
         return;
     }
-    make_huffman_limitedsize (litcounts, litcounts.size (), LIMIT, litsize);
-    make_huffman_limitedsize (distcounts, distcounts.size (), LIMIT, distsize);
-    compress_custom_table (litsize, distsize);
-    make_huffman_limitedsize (hccounts, hccounts.size (), 7, hcsize);
-    /* estimate bit length for each three type of blocks */
-    int stat_custom = estimate_stat_custom (hcsize, litsize, distsize);
-    int stat_non = std::max (stat_custom, stat_fixed) + 8;
-    if (stat_lendist == 0)
-        stat_non = estimate_stat_non ();
-    /* select shortest blocks type */
-    int stat_min = std::min (std::min (stat_custom, stat_fixed), stat_non);
-    if (stat_custom == stat_min)
-        encode_custom_block (hcsize, litsize, distsize);
-    else if (stat_fixed == stat_min)
-        encode_fixed_block ();
-    else
-        encode_plain_block ();
+    int stat_custom, stat_non, stat_min;
+    {
+        stats_timer timer (stats, &stream_stats::table_ns);
+        auto const make_size = fast ? make_huffman_fastsize
+            : make_huffman_limitedsize;
+        make_size (coded->litcounts, coded->litcounts.size (), LIMIT, litsize);
+        make_size (coded->distcounts, coded->distcounts.size (), LIMIT,
+            distsize);
+        compress_custom_table (litsize, distsize);
+        make_size (hccounts, hccounts.size (), 7, hcsize);
+        /* estimate bit length for each three type of blocks */
+        stat_custom = estimate_stat_custom (hcsize, litsize, distsize);
+        stat_non = std::max (stat_custom, coded->stat_fixed) + 8;
+        if (coded->stat_lendist == 0)
+            stat_non = estimate_stat_non ();
+        /* select shortest blocks type */
+        stat_min = std::min (std::min (stat_custom, coded->stat_fixed), stat_non);
+    }
+    int type;
+    {
+        stats_timer timer (stats, &stream_stats::output_ns);
+        if (stat_custom == stat_min) {
+            type = 2;
+            encode_custom_block (hcsize, litsize, distsize);
+        }
+        else if (coded->stat_fixed == stat_min) {
+            type = 1;
+            encode_fixed_block ();
+        }
+        else {
+            type = 0;
+            encode_plain_block ();
+        }
+    }
+    if (stats != nullptr)
+        record_block (type, stat_min);
+}
+
+/* add the block to the stats: the counts and the histograms come from
+ * the statistics for the block type selection.
+ */
+void huffman_encoder::record_block (int type, int bits)
+{
+    block_stats b = {type, coded->bfinal != 0, 0, 0,
+        static_cast<std::uint64_t> (coded->stat_lendist),
+        static_cast<std::uint64_t> (bits), 0, 0, 0, 0};
+    for (int c = 0; c < 256; ++c)
+        b.literals += coded->litcounts[c];
+    b.bytes = b.literals;
+    for (std::size_t i = 0; i < coded->codelist.size (); ++i)
+        if (coded->codelist[i] > 256) {
+            b.bytes += coded->codelist[i + 1];
+            i += 2;
+        }
+    for (int c = 257; c < 286; ++c)
+        stats->lengths[c - 257] += coded->litcounts[c];
+    for (int c = 0; c < 30; ++c)
+        stats->distances[c] += coded->distcounts[c];
+    if (type == 2) {
+        b.hlit = coded->litcounts.size () - 257;
+        b.hdist = coded->distcounts.size () - 1;
+        b.hclen = 19 - 4;
+        b.table_bits = 5 + 5 + 4 + 19 * 3
+            + hccounts[16] * 2 + hccounts[17] * 3 + hccounts[18] * 7;
+        for (std::size_t c = 0; c < hccounts.size (); ++c)
+            b.table_bits += hccounts[c] * hcsize[c];
+    }
+    stats->blocks.push_back (b);
+}
+
+/* 3.2.4. Non-compressed blocks (BTYPE=00)
+ *
+ * an empty non-final block byte-aligns the output for a flush point:
+ * the bytes 00 00 ff ff follow its header bits.
+ */
+void huffman_encoder::put_empty_stored_block ()
+{
+    wait ();
+    putbit (0);
+    putdata (2, 0);
+    align ();
+    put2byte (0);
+    put2byte (0xffff);
+    if (stats != nullptr)
+        stats->blocks.push_back (block_stats {0, false, 0, 0, 0, 3 + 32,
+            0, 0, 0, 0});
 }
 
 /* 3.2.4. Non-compressed blocks (BTYPE=00) */
 void huffman_encoder::encode_plain_block ()
 {
-    codelist.pop_back ();
-    int len = codelist.size ();
-    auto p = codelist.begin ();
+    coded->codelist.pop_back ();
+    int len = coded->codelist.size ();
+    auto p = coded->codelist.begin ();
     /* 2. Compressed representation overview
      * non-compressible blocks are limited to 65,535 bytes
      */
@@ -141,7 +291,7 @@ void huffman_encoder::encode_plain_block ()
             putbyte (*p++);
         len -= n;
     }
-    putbit (1);
+    putbit (coded->bfinal);
     putdata (2, 0);
     put2byte (len);
     put2byte (len ^ 0x0000ffffL);
@@ -152,10 +302,10 @@ void huffman_encoder::encode_plain_block ()
 /*  3.2.6. Compression with fixed Huffman codes (BTYPE=01) */
 void huffman_encoder::encode_fixed_block ()
 {
-    putbit (1);
+    putbit (coded->bfinal);
     putdata (2, 1);
-    for (std::size_t i = 0; i < codelist.size (); ++i) {
-        int c = codelist[i];
+    for (std::size_t i = 0; i < coded->codelist.size (); ++i) {
+        int c = coded->codelist[i];
         if (c <= 256) {
             int bits;
             std::uint32_t huff;
@@ -165,8 +315,8 @@ void huffman_encoder::encode_fixed_block ()
         else {
             int lencode, lenbits, lexbits, distcode, dexbits;
             std::uint32_t lenhuff, lextra, dextra;
-            int len = codelist[++i];
-            int dist = codelist[++i];
+            int len = coded->codelist[++i];
+            int dist = coded->codelist[++i];
             encode_length (len, lencode, lexbits, lextra);
             encode_distance (dist, distcode, dexbits, dextra);
             fixed_huffman_code (lencode, lenbits, lenhuff);
@@ -186,18 +336,15 @@ void huffman_encoder::encode_custom_block (
     std::vector<int> const& litsize,
     std::vector<int> const& distsize)
 {
-    std::vector<int> hcindex{
+    static int const hcindex[19] = {
         16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
-    std::vector<int> hchuff;
-    std::vector<int> lithuff;
-    std::vector<int> disthuff;
     make_huffman_canonical (hcsize, LIMIT, hchuff);
     make_huffman_canonical (litsize, LIMIT, lithuff);
     make_huffman_canonical (distsize, LIMIT, disthuff);
-    putbit (1);
+    putbit (coded->bfinal);
     putdata (2, 2);
-    putdata (5, litcounts.size () - 257);
-    putdata (5, distcounts.size () - 1);
+    putdata (5, coded->litcounts.size () - 257);
+    putdata (5, coded->distcounts.size () - 1);
     putdata (4, 19 - 4);
     /* (HCLEN + 4) x 3 bits: code lengths for the code length alphabet*/
     for (int i : hcindex)
@@ -220,15 +367,15 @@ void huffman_encoder::encode_custom_block (
     /* The actual compressed data of the block,
      * The literal/length symbol 256 (end of data)
      */
-    for (std::size_t i = 0; i < codelist.size (); ++i) {
-        int c = codelist[i];
+    for (std::size_t i = 0; i < coded->codelist.size (); ++i) {
+        int c = coded->codelist[i];
         if (c <= 256)
             puthuffman (litsize[c], lithuff[c]);
         else {
             int lencode, lexbits, distcode, dexbits;
             std::uint32_t lextra, dextra;
-            int len = codelist[++i];
-            int dist = codelist[++i];
+            int len = coded->codelist[++i];
+            int dist = coded->codelist[++i];
             encode_length (len, lencode, lexbits, lextra);
             encode_distance (dist, distcode, dexbits, dextra);
             puthuffman (litsize[lencode], lithuff[lencode]);
@@ -246,24 +393,24 @@ int huffman_encoder::estimate_stat_custom (
     std::vector<int> const& litsize,
     std::vector<int> const& distsize)
 {
-    int n = 5 + 5 + 4 + stat_extra;
+    int n = 5 + 5 + 4 + coded->stat_extra;
     n += hccounts.size () * 3;
     for (std::size_t i = 0; i < hccounts.size (); ++i) {
         n += hccounts[i] * hcsize[i];
     }
-    for (std::size_t i = 0; i < litcounts.size (); ++i) {
-        n += litcounts[i] * litsize[i];
+    for (std::size_t i = 0; i < coded->litcounts.size (); ++i) {
+        n += coded->litcounts[i] * litsize[i];
     }
-    for (std::size_t i = 0; i < distcounts.size (); ++i) {
-        n += distcounts[i] * distsize[i];
+    for (std::size_t i = 0; i < coded->distcounts.size (); ++i) {
+        n += coded->distcounts[i] * distsize[i];
     }
     return n;
 }
 
 int huffman_encoder::estimate_stat_non ()
 {
-    int m = (codelist.size () - 1) / 65535;
-    int n = (codelist.size () - 1) % 65535;
+    int m = (coded->codelist.size () - 1) / 65535;
+    int n = (coded->codelist.size () - 1) % 65535;
     return m * (65535 * 8 + 32) + n * 8 + 32;
 }
 
@@ -329,30 +476,30 @@ void huffman_encoder::compress_custom_table (
     std::vector<int> const& litsize,
     std::vector<int> const& distsize)
 {
-    std::vector<int> code;
-    std::vector<int> runlength;
+    rlcode.clear ();
+    rlcount.clear ();
     /* code lengths for the literal/length alphabet */
     for (int c : litsize)
-        if (! code.empty () && code.back () == c)
-            ++runlength[runlength.size () - 1];
+        if (! rlcode.empty () && rlcode.back () == c)
+            ++rlcount.back ();
         else {
-            code.push_back (c);
-            runlength.push_back (1);
+            rlcode.push_back (c);
+            rlcount.push_back (1);
         }
     /* code lengths for the distance alphabet */
     for (int c : distsize)
-        if (! code.empty () && code.back () == c)
-            ++runlength[runlength.size () - 1];
+        if (! rlcode.empty () && rlcode.back () == c)
+            ++rlcount.back ();
         else {
-            code.push_back (c);
-            runlength.push_back (1);
+            rlcode.push_back (c);
+            rlcount.push_back (1);
         }
     /* encoded using the code length Huffman code */
-    for (std::size_t i = 0; i < code.size (); ++i)
-        if (code[i] == 0)
-            runlength_zeros (runlength[i]);
+    for (std::size_t i = 0; i < rlcode.size (); ++i)
+        if (rlcode[i] == 0)
+            runlength_zeros (rlcount[i]);
         else
-            runlength_nonzeros (code[i], runlength[i]);
+            runlength_nonzeros (rlcode[i], rlcount[i]);
 }
 
 /* 3.2.7. Compression with dynamic Huffman codes (BTYPE=10) */
@@ -365,13 +512,13 @@ void huffman_encoder::runlength_nonzeros (int c, int n)
         hclist.push_back (16);
         hclist.push_back (3);
         ++hccounts[16];
-        stat_extra += 2;
+        coded->stat_extra += 2;
     }
     if (n >= 3) {
         hclist.push_back (16);
         hclist.push_back (n - 3);
         ++hccounts[16];
-        stat_extra += 2;
+        coded->stat_extra += 2;
     }
     else if (n > 0) {
         for (int i = 0; i < n; ++i)
@@ -387,19 +534,19 @@ void huffman_encoder::runlength_zeros (int n)
         hclist.push_back (18);
         hclist.push_back (127);
         ++hccounts[18];
-        stat_extra += 7;
+        coded->stat_extra += 7;
     }
     if (n >= 11) {
         hclist.push_back (18);
         hclist.push_back (n - 11);
         ++hccounts[18];
-        stat_extra += 7;
+        coded->stat_extra += 7;
     }
     else if (n >= 3) {
         hclist.push_back (17);
         hclist.push_back (n - 3);
         ++hccounts[17];
-        stat_extra += 3;
+        coded->stat_extra += 3;
     }
     else if (n > 0) {
         for (int i = 0; i < n; ++i)
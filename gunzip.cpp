@@ -40,41 +40,149 @@
 
 namespace deflate {
 
-void gunzip ()
+void gunzip (int format, int nthreads, stream_stats* stats)
 {
-    std::string s;
-    auto crc32 = std::make_shared<digest_crc32> ();
-    lzss_compression lzss (crc32);
-    huffman_decoder decoder (std::cin, lzss);
-    std::uint32_t id1 = decoder.getbyte ();
-    std::uint32_t id2 = decoder.getbyte ();
-    if (id1 != 0x1f || id2 != 0x8b)
+    gunzip_stream (std::cin, &std::cout, format, nthreads, stats);
+}
+
+/* decode cin into cout, or only check it when cout is nullptr */
+void gunzip_stream (std::istream& cin, std::ostream* cout,
+    int format, int nthreads, stream_stats* stats)
+{
+    if (format == FORMAT_ZLIB) {
+        zlib_decompress (cin, cout, stats);
+        return;
+    }
+    if (format == FORMAT_RAW) {
+        raw_decompress (cin, cout, stats);
+        return;
+    }
+    bool first = true;
+    while (first || cin.peek () != EOF) {
+        gzip_header header;
+        bitinput input (cin);
+        read_gzip_header (input, header);
+        if (header.bsize >= 0 && cout != nullptr) {
+            /* BGZF: hand the rest of the members to the thread pool */
+            bgzf_decompress (cin, *cout, header, 0, nthreads, stats);
+            return;
+        }
+        gunzip_member (cin, cout, stats);
+        first = false;
+    }
+}
+
+static std::uint32_t header_byte (std::string const& s, std::size_t i)
+{
+    return static_cast<std::uint8_t> (s[i]);
+}
+
+/* 2.3. Member format
+ *
+ * parse a member header at the front of s. it returns the header size,
+ * or 0 when s is too short, then header.length tells the least size of s
+ * to try again.
+ */
+std::size_t parse_gzip_header (std::string const& s, gzip_header& header)
+{
+    if ((s.size () > 0 && header_byte (s, 0) != 0x1f)
+            || (s.size () > 1 && header_byte (s, 1) != 0x8b))
         throw std::runtime_error ("cppgzip: illegal id1 and id2.");
-    std::uint32_t cm = decoder.getbyte ();
-    if (cm != 8)
+    if (s.size () > 2 && header_byte (s, 2) != 8)
         throw std::runtime_error ("cppgzip: illegal cm.");
-    std::uint32_t flg = decoder.getbyte ();
-    /* std::uint32_t mtime = */ decoder.get4byte ();
-    /* std::uint32_t xfl = */   decoder.getbyte ();
-    /* std::uint32_t os = */    decoder.getbyte ();
-    if (flg & 4) {
-        std::uint32_t xlen = decoder.get2byte ();
-        for (std::uint32_t i = 0; i < xlen; ++i)
-            decoder.getbyte ();
+    header.length = 10;
+    if (s.size () < header.length)
+        return 0;
+    header.flg = header_byte (s, 3);
+    header.mtime = header_byte (s, 4) | (header_byte (s, 5) << 8)
+        | (header_byte (s, 6) << 16) | (header_byte (s, 7) << 24);
+    header.xfl = header_byte (s, 8);
+    header.os = header_byte (s, 9);
+    header.extra.clear ();
+    header.name.clear ();
+    header.comment.clear ();
+    header.bsize = -1;
+    header.msize = -1;
+    std::size_t pos = 10;
+    if (header.flg & 4) {
+        header.length = pos + 2;
+        if (s.size () < header.length)
+            return 0;
+        std::size_t xlen = header_byte (s, pos) | (header_byte (s, pos + 1) << 8);
+        pos += 2;
+        header.length = pos + xlen;
+        if (s.size () < header.length)
+            return 0;
+        header.extra.assign (s, pos, xlen);
+        pos += xlen;
+        /* subfields: SI1 SI2 LEN(2 bytes) data */
+        std::string const& x = header.extra;
+        for (std::size_t i = 0; i + 4 <= x.size ();) {
+            std::uint32_t slen = header_byte (x, i + 2) | (header_byte (x, i + 3) << 8);
+            if (x[i] == 'B' && x[i + 1] == 'C' && slen == 2 && i + 6 <= x.size ())
+                header.bsize = header_byte (x, i + 4) | (header_byte (x, i + 5) << 8);
+            if (x[i] == 'S' && x[i + 1] == 'P' && slen == 4 && i + 8 <= x.size ())
+                header.msize = header_byte (x, i + 4) | (header_byte (x, i + 5) << 8)
+                    | (header_byte (x, i + 6) << 16)
+                    | (static_cast<std::int64_t> (header_byte (x, i + 7)) << 24);
+            i += 4 + slen;
+        }
+    }
+    if (header.flg & 8) {
+        std::size_t const z = s.find ('\0', pos);
+        if (z == std::string::npos) {
+            header.length = s.size () + 1;
+            return 0;
+        }
+        header.name.assign (s, pos, z - pos);
+        pos = z + 1;
+    }
+    if (header.flg & 16) {
+        std::size_t const z = s.find ('\0', pos);
+        if (z == std::string::npos) {
+            header.length = s.size () + 1;
+            return 0;
+        }
+        header.comment.assign (s, pos, z - pos);
+        pos = z + 1;
     }
-    if (flg & 8)
-        decoder.getasciiz (s);
-    if (flg & 16)
-        decoder.getasciiz (s);
-    if (flg & 2)
-        decoder.get2byte ();
-    std::size_t got_isize = decoder.decode (std::cout);
+    if (header.flg & 2) {
+        header.length = pos + 2;
+        if (s.size () < header.length)
+            return 0;
+        pos += 2;
+    }
+    header.length = pos;
+    return pos;
+}
+
+void read_gzip_header (bitinput& input, gzip_header& header)
+{
+    std::string s;
+    while (parse_gzip_header (s, header) == 0)
+        while (s.size () < header.length)
+            s.push_back (input.getbyte ());
+}
+
+/* decode the compressed blocks and the trailer of a member */
+std::size_t gunzip_member (std::istream& cin, std::ostream* cout,
+    stream_stats* stats)
+{
+    auto crc32 = std::make_shared<digest_crc32> ();
+    lzss_compression lzss (crc32);
+    huffman_decoder decoder (cin, lzss);
+    decoder.set_stats (stats);
+    std::size_t got_isize
+        = cout != nullptr ? decoder.decode (*cout) : decoder.decode ();
     std::uint32_t expected_crc32 = decoder.get4byte ();
     std::uint32_t expected_isize = decoder.get4byte ();
     if (crc32->digest () != expected_crc32)
         throw std::runtime_error ("cppgzip: mismatch CRC32.");
-    if (got_isize != expected_isize)
+    if ((got_isize & 0xffffffffL) != expected_isize)
         throw std::runtime_error ("cppgzip: mismatch ISIZE.");
+    if (stats != nullptr)
+        stats->output += got_isize;
+    return got_isize;
 }
 
 }// namespace deflate
@@ -0,0 +1,341 @@
+/* compression/decompression of named files
+ *
+ *  1. the input file is memory-mapped, and given to the stream as
+ *     a single span.
+ *  2. the compressed output goes out in large chunks by write(2).
+ *  3. the decompressed output is a writable mapping preallocated from
+ *     ISIZE of the last member, and it grows twice when it is short.
+ *  4. BGZF goes through the block-parallel path over file streams.
+ *  5. the input file is kept, and an existing output is not replaced.
+ *
+ * References:
+ *
+ *  P. Deutsch, ``RFC 1952 GZIP file format specification version 4.3'', 1996,
+ *     2.3.1. Member header and trailer, ISIZE
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "deflate.hpp"
+
+namespace deflate {
+
+enum {OUTCHUNK = 1024 * 1024};
+
+static void throw_errno (std::string const& path)
+{
+    throw std::runtime_error ("cppgzip: " + path + ": " + std::strerror (errno));
+}
+
+mapped_file::mapped_file (std::string const& path)
+    : addr (nullptr), len (0)
+{
+    int const fd = ::open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+        throw_errno (path);
+    struct stat st;
+    if (::fstat (fd, &st) < 0 || ! S_ISREG (st.st_mode)) {
+        ::close (fd);
+        throw std::runtime_error ("cppgzip: " + path + ": not a regular file.");
+    }
+    len = st.st_size;
+    if (len > 0) {
+        void* p = ::mmap (nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close (fd);
+            throw_errno (path);
+        }
+        ::madvise (p, len, MADV_SEQUENTIAL);
+        addr = static_cast<std::uint8_t*> (p);
+    }
+    ::close (fd);
+}
+
+mapped_file::~mapped_file ()
+{
+    if (addr != nullptr)
+        ::munmap (addr, len);
+}
+
+/* the writable mapping of the output file. the file is removed unless
+ * it has been committed.
+ */
+class mapped_output {
+public:
+    mapped_output (std::string const& apath, std::size_t capacity);
+    ~mapped_output ();
+    std::uint8_t* data () const { return addr; }
+    std::size_t capacity () const { return len; }
+    void resize (std::size_t capacity);
+    void commit (std::size_t size);
+private:
+    std::string path;
+    int fd;
+    std::uint8_t* addr;
+    std::size_t len;
+    void unmap ();
+};
+
+mapped_output::mapped_output (std::string const& apath, std::size_t capacity)
+    : path (apath), fd (-1), addr (nullptr), len (0)
+{
+    fd = ::open (path.c_str (), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        throw_errno (path);
+    resize (capacity);
+}
+
+mapped_output::~mapped_output ()
+{
+    if (fd >= 0) {
+        unmap ();
+        ::close (fd);
+        ::unlink (path.c_str ());
+    }
+}
+
+void mapped_output::unmap ()
+{
+    if (addr != nullptr)
+        ::munmap (addr, len);
+    addr = nullptr;
+}
+
+void mapped_output::resize (std::size_t capacity)
+{
+    unmap ();
+    len = std::max (capacity, static_cast<std::size_t> (4096));
+    if (::ftruncate (fd, len) < 0)
+        throw_errno (path);
+    /* take the blocks at once, if the file system can. */
+    ::posix_fallocate (fd, 0, len);
+    void* p = ::mmap (nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        throw_errno (path);
+    addr = static_cast<std::uint8_t*> (p);
+}
+
+void mapped_output::commit (std::size_t size)
+{
+    unmap ();
+    if (::ftruncate (fd, size) < 0)
+        throw_errno (path);
+    if (::close (fd) < 0)
+        throw_errno (path);
+    fd = -1;
+}
+
+std::string file_suffix (int const format)
+{
+    return format == FORMAT_ZLIB ? ".zz" : format == FORMAT_RAW ? ".deflate" : ".gz";
+}
+
+/* the output size of a gzip file from the ISIZE of its last member,
+ * clamped to what the input can expand to, so that a forged trailer
+ * never reserves more than that.
+ */
+std::size_t isize_hint (std::uint8_t const* p, std::size_t n)
+{
+    if (n < 18)
+        return n * 4;
+    std::uint8_t const* t = p + n - 4;
+    std::size_t const isize = t[0] | (t[1] << 8) | (t[2] << 16)
+        | (static_cast<std::size_t> (t[3]) << 24);
+    return std::min (isize, n * MAXRATIO);
+}
+
+static void check_absent (std::string const& path)
+{
+    struct stat st;
+    if (::stat (path.c_str (), &st) == 0)
+        throw std::runtime_error ("cppgzip: " + path + ": already exists.");
+}
+
+static void write_all (int fd, std::string const& path,
+    std::uint8_t const* p, std::size_t n)
+{
+    while (n > 0) {
+        ssize_t const m = ::write (fd, p, n);
+        if (m < 0) {
+            if (errno == EINTR)
+                continue;
+            throw_errno (path);
+        }
+        p += m;
+        n -= m;
+    }
+}
+
+/* the pass through file streams for the block-parallel BGZF */
+static void bgzf_file (std::string const& inpath, std::string const& outpath,
+    bool decompress, int format, int nthreads)
+{
+    check_absent (outpath);
+    std::ifstream cin (inpath, std::ios::in | std::ios::binary);
+    if (! cin)
+        throw_errno (inpath);
+    std::ofstream cout (outpath, std::ios::out | std::ios::binary);
+    if (! cout)
+        throw_errno (outpath);
+    try {
+        if (decompress)
+            gunzip_stream (cin, &cout, format, nthreads);
+        else
+            bgzf_compress (cin, cout, nthreads);
+        cout.close ();
+        if (! cout)
+            throw_errno (outpath);
+    }
+    catch (...) {
+        cout.close ();
+        ::unlink (outpath.c_str ());
+        throw;
+    }
+}
+
+/* compress a span into a member or a stream, giving the output to put
+ * in large chunks. it runs on the reusable stream of the calling thread.
+ */
+void compress_span (int format, std::uint8_t const* p, std::size_t n,
+    std::function<void(std::uint8_t const*, std::size_t)> const& put)
+{
+    static thread_local std::vector<std::uint8_t> chunk (OUTCHUNK);
+    deflate_stream& z = thread_deflate_stream (format);
+    int r;
+    do {
+        std::uint8_t* next_out = &chunk[0];
+        std::size_t avail_out = chunk.size ();
+        r = z.compress (p, n, next_out, avail_out, STREAM_FINISH);
+        put (&chunk[0], chunk.size () - avail_out);
+    } while (r != STREAM_END);
+}
+
+/* write the parts into a new file in order */
+void write_parts (std::string const& path,
+    std::vector<std::string> const& parts)
+{
+    int const fd = ::open (path.c_str (), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        throw_errno (path);
+    try {
+        for (std::string const& s : parts)
+            write_all (fd, path,
+                reinterpret_cast<std::uint8_t const*> (s.data ()), s.size ());
+        if (::close (fd) < 0)
+            throw_errno (path);
+    }
+    catch (...) {
+        ::close (fd);
+        ::unlink (path.c_str ());
+        throw;
+    }
+}
+
+void gzip_file (std::string const& path, int format, int nthreads)
+{
+    std::string const outpath = path + file_suffix (format);
+    if (format == FORMAT_BGZF) {
+        bgzf_file (path, outpath, false, format, nthreads);
+        return;
+    }
+    mapped_file input (path);
+    check_absent (outpath);
+    int const fd = ::open (outpath.c_str (), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        throw_errno (outpath);
+    try {
+        compress_span (format, input.data (), input.size (),
+            [&](std::uint8_t const* p, std::size_t n) {
+                write_all (fd, outpath, p, n);
+            });
+        if (::close (fd) < 0)
+            throw_errno (outpath);
+    }
+    catch (...) {
+        ::close (fd);
+        ::unlink (outpath.c_str ());
+        throw;
+    }
+}
+
+void gunzip_file (std::string const& path, int format, int nthreads)
+{
+    std::string const suffix = file_suffix (format);
+    if (path.size () <= suffix.size ()
+            || path.compare (path.size () - suffix.size (), suffix.size (), suffix) != 0)
+        throw std::runtime_error ("cppgzip: " + path + ": unknown suffix.");
+    std::string const outpath = path.substr (0, path.size () - suffix.size ());
+    mapped_file input (path);
+    std::uint8_t const* next_in = input.data ();
+    std::size_t avail_in = input.size ();
+    std::size_t hint = avail_in * 4;
+    if (format == FORMAT_GZIP || format == FORMAT_BGZF) {
+        gzip_header header;
+        std::string const s (next_in, next_in + std::min (avail_in,
+            static_cast<std::size_t> (OUTCHUNK)));
+        if (parse_gzip_header (s, header) > 0 && header.bsize >= 0) {
+            bgzf_file (path, outpath, true, format, nthreads);
+            return;
+        }
+        /* ISIZE of the last member: the size of a single member file */
+        hint = isize_hint (next_in, avail_in);
+    }
+    check_absent (outpath);
+    mapped_output output (outpath, hint);
+    inflate_stream& z = thread_inflate_stream (format);
+    std::size_t used = 0;
+    for (;;) {
+        std::uint8_t* next_out = output.data () + used;
+        std::size_t avail_out = output.capacity () - used;
+        int const r = z.decompress (next_in, avail_in, next_out, avail_out);
+        used = next_out - output.data ();
+        if (r == STREAM_END && avail_in == 0)
+            break;
+        if (r == STREAM_END && (format == FORMAT_ZLIB || format == FORMAT_RAW))
+            break;
+        if (r == STREAM_NEED_INPUT)
+            throw std::runtime_error ("cppgzip: " + path + ": unexpected end-of-file.");
+        if (r == STREAM_OUTPUT_FULL)
+            output.resize (output.capacity () * 2);
+    }
+    output.commit (used);
+}
+
+}// namespace deflate
@@ -0,0 +1,254 @@
+/* search of decompressed streams for lines, as zgrep
+ *
+ *  1. the lines are matched in the spans of the inflate_reader, in place
+ *     in the ring buffer of the decoder, with no output copy nor pipe.
+ *  2. the fixed strings are found over all the whole lines of a span by
+ *     memmem, keeping the next hit of each string, and only the lines
+ *     with a hit are cut out. the regular expressions, ECMAScript of
+ *     std::regex, are tried line by line.
+ *  3. a line cut at the end of a span is carried over in a buffer of its
+ *     own until its newline.
+ *  4. the decoding stops with the last line to be printed.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cstring>
+#include <regex>
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+enum {GREPCHUNK = 65536};
+
+/* the patterns of the options, either of which a line contains */
+class line_matcher {
+public:
+    explicit line_matcher (grep_options const& options);
+    void start ();
+    char const* find (char const* p, char const* end);
+    bool matches (char const* b, char const* e) const;
+private:
+    std::vector<std::string> const& patterns;
+    bool regex;
+    std::regex re;
+    std::vector<char const*> hits;
+};
+
+line_matcher::line_matcher (grep_options const& options)
+    : patterns (options.patterns), regex (options.regex), re (),
+      hits (options.patterns.size (), nullptr)
+{
+    if (! regex)
+        return;
+    std::string alternation;
+    for (std::string const& pattern : patterns) {
+        if (! alternation.empty ())
+            alternation += '|';
+        alternation += "(?:" + pattern + ")";
+    }
+    try {
+        re.assign (alternation, std::regex::ECMAScript | std::regex::optimize);
+    }
+    catch (std::regex_error& e) {
+        throw std::runtime_error (std::string ("gzgrep: ") + e.what () + ".");
+    }
+}
+
+/* forget the hits of the last span */
+void line_matcher::start ()
+{
+    std::fill (hits.begin (), hits.end (), nullptr);
+}
+
+/* the first line in the whole lines from p to end with a match, or end */
+char const* line_matcher::find (char const* p, char const* end)
+{
+    if (regex) {
+        while (p < end) {
+            char const* e = static_cast<char const*> (
+                std::memchr (p, '\n', end - p));
+            if (e == nullptr)
+                e = end;
+            if (std::regex_search (p, e, re))
+                return p;
+            p = e + 1;
+        }
+        return end;
+    }
+    /* the hits of the strings stay until the lines pass them, and end
+     * tells no more hits in the span.
+     */
+    char const* hit = end;
+    for (std::size_t i = 0; i < patterns.size (); ++i) {
+        if (hits[i] == nullptr || hits[i] < p) {
+            void const* q = ::memmem (p, end - p,
+                patterns[i].data (), patterns[i].size ());
+            hits[i] = q != nullptr ? static_cast<char const*> (q) : end;
+        }
+        hit = std::min (hit, hits[i]);
+    }
+    if (hit == end)
+        return end;
+    while (hit > p && hit[-1] != '\n')
+        --hit;
+    return hit;
+}
+
+bool line_matcher::matches (char const* b, char const* e) const
+{
+    if (regex)
+        return std::regex_search (b, e, re);
+    for (std::string const& pattern : patterns)
+        if (::memmem (b, e - b, pattern.data (), pattern.size ()) != nullptr)
+            return true;
+    return false;
+}
+
+/* print the matching lines of a stream, and return their number */
+static std::uint64_t grep_stream (inflate_reader& reader, line_matcher& matcher,
+    grep_options const& options, std::string const& prefix, std::ostream& out)
+{
+    std::uint64_t matched = 0;
+    auto put_line = [&](char const* b, char const* e, std::uint64_t at) {
+        out << prefix;
+        if (options.offsets)
+            out << at << ':';
+        out.write (b, e - b);
+        out.put ('\n');
+        ++matched;
+    };
+    auto done = [&]() {
+        return options.max_count > 0 && matched >= options.max_count;
+    };
+    std::string carry;          /* the line cut at the end of the last span */
+    std::uint64_t carry_at = 0;
+    std::uint64_t pos = 0;      /* the offset of the span */
+    std::uint8_t const* span;
+    while (! done ()) {
+        std::size_t const n = reader.next_chunk (span);
+        if (n == 0)
+            break;
+        char const* const start = reinterpret_cast<char const*> (span);
+        char const* const end = start + n;
+        char const* p = start;
+        if (! carry.empty ()) {
+            char const* nl = static_cast<char const*> (
+                std::memchr (p, '\n', n));
+            if (nl == nullptr) {
+                carry.append (p, end);
+                pos += n;
+                continue;
+            }
+            carry.append (p, nl);
+            char const* const b = carry.data ();
+            if (matcher.matches (b, b + carry.size ()))
+                put_line (b, b + carry.size (), carry_at);
+            carry.clear ();
+            p = nl + 1;
+        }
+        /* the whole lines of the span, and the rest is carried over */
+        char const* last = end;
+        while (last > p && last[-1] != '\n')
+            --last;
+        matcher.start ();
+        while (p < last && ! done ()) {
+            char const* const b = matcher.find (p, last);
+            if (b == last)
+                break;
+            char const* const e = static_cast<char const*> (
+                std::memchr (b, '\n', last - b));
+            put_line (b, e, pos + (b - start));
+            p = e + 1;
+        }
+        carry.assign (last, end);
+        carry_at = pos + (last - start);
+        pos += n;
+    }
+    /* the last line without a newline */
+    if (! carry.empty () && ! done ()) {
+        char const* const b = carry.data ();
+        if (matcher.matches (b, b + carry.size ()))
+            put_line (b, b + carry.size (), carry_at);
+    }
+    return matched;
+}
+
+/* search the files, or stdin without them. the lines take the path
+ * before them when there are two or more files. return 0 when a line
+ * matched, 1 when none did, and 2 when a file failed, as grep.
+ */
+int gzgrep (std::vector<std::string> const& paths, int format,
+    grep_options const& options, std::ostream& out, std::ostream& report)
+{
+    std::unique_ptr<line_matcher> matcher;
+    try {
+        matcher.reset (new line_matcher (options));
+    }
+    catch (std::exception& e) {
+        report << e.what () << std::endl;
+        return 2;
+    }
+    /* BGZF is a series of gzip members */
+    int const rformat = format == FORMAT_BGZF ? FORMAT_GZIP : format;
+    std::uint64_t matched = 0;
+    bool failed = false;
+    if (paths.empty ()) {
+        try {
+            inflate_reader reader (std::cin, rformat, GREPCHUNK);
+            matched += grep_stream (reader, *matcher, options, "", out);
+        }
+        catch (std::exception& e) {
+            report << "(stdin): FAILED " << e.what () << std::endl;
+            failed = true;
+        }
+    }
+    for (std::string const& path : paths) {
+        try {
+            mapped_file input (path);
+            inflate_reader reader (input.data (), input.size (), rformat,
+                GREPCHUNK);
+            matched += grep_stream (reader, *matcher, options,
+                paths.size () > 1 ? path + ":" : std::string (), out);
+        }
+        catch (std::exception& e) {
+            out.flush ();
+            report << path << ": FAILED " << e.what () << std::endl;
+            failed = true;
+        }
+    }
+    out.flush ();
+    return failed ? 2 : matched > 0 ? 0 : 1;
+}
+
+}// namespace deflate
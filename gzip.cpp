@@ -35,28 +35,46 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include "deflate.hpp"
 
 namespace deflate {
 
-void gzip ()
+void gzip (int format, int nthreads, flush_policy const& policy,
+    stream_stats* stats, int profile)
 {
-    auto crc32 = std::make_shared<digest_crc32> ();
-    lzss_compression lzss (crc32);
-    huffman_encoder encoder (std::cout);
-
-    encoder.putbyte (0x1fL);
-    encoder.putbyte (0x8bL);
-    encoder.putbyte (8);
-    encoder.putbyte (0);
-    encoder.put4byte (0);
-    encoder.putbyte (0);
-    encoder.putbyte (3);
+    if (format == FORMAT_BGZF) {
+        bgzf_compress (std::cin, std::cout, nthreads);
+        return;
+    }
+    /* stdin and stdout */
+    gzip_pipeline (format, 0, 1, policy, stats, profile, nthreads);
+}
 
-    int size = lzss.compress(std::cin, encoder);
+void put_gzip_header (bitoutput& output)
+{
+    output.putbyte (0x1fL);
+    output.putbyte (0x8bL);
+    output.putbyte (8);
+    output.putbyte (0);
+    output.put4byte (0);
+    output.putbyte (0);
+    output.putbyte (3);
+}
 
-    encoder.put4byte (crc32->digest ());
-    encoder.put4byte (size);
+/* the header of a split member: that of put_gzip_header with FEXTRA, and
+ * the SP subfield of the member size, so that a listing hops over them.
+ */
+void put_split_header (std::uint8_t* p, std::uint32_t msize)
+{
+    static std::uint8_t const header[16] = {
+        0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 3,
+        8, 0,               /* XLEN */
+        'S', 'P', 4, 0      /* SI1 SI2 LEN */
+    };
+    std::copy (header, header + sizeof header, p);
+    for (int i = 0; i < 4; ++i)
+        p[sizeof header + i] = msize >> (8 * i);
 }
 
 }// namespace deflate
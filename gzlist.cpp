@@ -0,0 +1,290 @@
+/* listing of gzip files from the headers and the trailers
+ *
+ *  1. read the header of the first member for FNAME and MTIME, and
+ *     the trailer at the end of the file for CRC32 and ISIZE, without
+ *     decoding the data.
+ *  2. a BGZF file hops from a member to the next by BSIZE, and a file
+ *     cut into members by this program by their SP subfields, reading
+ *     only their headers and trailers.
+ *  3. any other file may be members concatenated, so it is decoded
+ *     without output, in place in the ring buffer of the decoder, to
+ *     find the trailer of each member.
+ *  4. the CRCs of the members combine into the CRC of the whole.
+ *  5. the files are read concurrently on a thread pool, and listed in
+ *     the order of the arguments.
+ *
+ * References:
+ *
+ *  P. Deutsch, ``RFC 1952 GZIP file format specification version 4.3'', 1996,
+ *     2.3.1. Member header and trailer
+ *  The SAM/BAM Format Specification, 4.1 The BGZF compression format
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "deflate.hpp"
+
+namespace deflate {
+
+struct list_entry {
+    std::uint64_t compressed;
+    std::uint64_t uncompressed;
+    std::uint32_t crc;
+    std::uint64_t members;
+    std::uint32_t mtime;
+    std::string name;
+    std::string error;
+};
+
+static void read_at (int fd, std::string const& path, std::uint64_t off,
+    std::size_t n, std::string& s)
+{
+    s.resize (n);
+    for (std::size_t done = 0; done < n;) {
+        ssize_t const m = ::pread (fd, &s[done], n - done, off + done);
+        if (m < 0 && errno == EINTR)
+            continue;
+        if (m < 0)
+            throw std::runtime_error ("cppgzip: " + path + ": "
+                + std::strerror (errno));
+        if (m == 0)
+            throw std::runtime_error ("cppgzip: " + path
+                + ": unexpected end-of-file.");
+        done += m;
+    }
+}
+
+static std::uint32_t get4byte (std::uint8_t const* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16)
+        | (static_cast<std::uint32_t> (p[3]) << 24);
+}
+
+/* the header of the member at off, reading on while a name runs on */
+static void read_member_header (int fd, std::string const& path,
+    std::uint64_t off, std::uint64_t size, gzip_header& header)
+{
+    std::string s;
+    for (std::uint64_t n = 512;; n *= 2) {
+        std::uint64_t const m = std::min (n, size - off);
+        read_at (fd, path, off, m, s);
+        if (parse_gzip_header (s, header) > 0)
+            return;
+        if (m == size - off)
+            throw std::runtime_error ("cppgzip: " + path
+                + ": truncated header.");
+    }
+}
+
+/* take the trailer of a member: CRC32 and ISIZE */
+static void add_member (list_entry& e, std::uint8_t const* trailer)
+{
+    std::uint32_t const crc = get4byte (trailer);
+    std::uint32_t const isize = get4byte (trailer + 4);
+    e.crc = e.members == 0 ? crc : digest_crc32::combine (e.crc, crc, isize);
+    e.uncompressed += isize;
+    ++e.members;
+}
+
+/* the member size told by the header, BSIZE of BGZF or SP of a split
+ * member, or -1
+ */
+static std::int64_t member_size (gzip_header const& header)
+{
+    return header.bsize >= 0 ? header.bsize + 1 : header.msize;
+}
+
+/* the members without their sizes in the headers end where the decoder
+ * stops at each of them, just after the trailer.
+ */
+static void walk_members (std::string const& path, list_entry& e)
+{
+    mapped_file input (path);
+    std::uint8_t const* next_in = input.data ();
+    std::size_t avail_in = input.size ();
+    inflate_stream& z = thread_inflate_stream (FORMAT_GZIP);
+    for (;;) {
+        std::uint8_t const* span;
+        std::size_t size;
+        int const r = z.decompress_span (next_in, avail_in, span, size);
+        if (r == STREAM_NEED_INPUT)
+            throw std::runtime_error ("cppgzip: " + path
+                + ": unexpected end-of-file.");
+        if (r == STREAM_END) {
+            add_member (e, next_in - 8);
+            if (avail_in == 0)
+                return;
+        }
+    }
+}
+
+static void list_file (std::string const& path, list_entry& e)
+{
+    int const fd = ::open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error ("cppgzip: " + path + ": "
+            + std::strerror (errno));
+    try {
+        struct stat st;
+        if (::fstat (fd, &st) < 0 || ! S_ISREG (st.st_mode))
+            throw std::runtime_error ("cppgzip: " + path
+                + ": not a regular file.");
+        std::uint64_t const size = st.st_size;
+        if (size < 18)
+            throw std::runtime_error ("cppgzip: " + path
+                + ": not in gzip format.");
+        e.compressed = size;
+        gzip_header header;
+        read_member_header (fd, path, 0, size, header);
+        e.mtime = header.mtime;
+        e.name = header.name;
+        std::string trailer;
+        if (member_size (header) >= 0) {
+            for (std::uint64_t off = 0; off < size;) {
+                if (off > 0)
+                    read_member_header (fd, path, off, size, header);
+                std::int64_t const msize = member_size (header);
+                std::uint64_t const end = off + msize;
+                if (msize < 18 || end > size)
+                    throw std::runtime_error ("cppgzip: " + path
+                        + ": broken member size.");
+                read_at (fd, path, end - 8, 8, trailer);
+                add_member (e,
+                    reinterpret_cast<std::uint8_t const*> (trailer.data ()));
+                off = end;
+            }
+        }
+        else
+            walk_members (path, e);
+    }
+    catch (...) {
+        ::close (fd);
+        throw;
+    }
+    ::close (fd);
+}
+
+static void put_sizes (std::ostream& report, std::uint64_t compressed,
+    std::uint64_t uncompressed)
+{
+    double const ratio = uncompressed == 0 ? 0.0
+        : 100.0 * (1.0 - static_cast<double> (compressed) / uncompressed);
+    report << std::setw (12) << compressed << " " << std::setw (12)
+        << uncompressed << " " << std::setw (6) << std::fixed
+        << std::setprecision (1) << ratio << "% ";
+}
+
+static void put_entry (std::ostream& report, std::string const& path,
+    list_entry const& e)
+{
+    put_sizes (report, e.compressed, e.uncompressed);
+    report << std::hex << std::setfill ('0') << std::setw (8) << e.crc
+        << std::dec << std::setfill (' ') << " " << std::setw (7)
+        << e.members << " ";
+    if (e.mtime == 0)
+        report << std::setw (16) << "-";
+    else {
+        std::time_t const t = e.mtime;
+        struct tm tm;
+        char date[32];
+        ::localtime_r (&t, &tm);
+        std::strftime (date, sizeof date, "%Y-%m-%d %H:%M", &tm);
+        report << date;
+    }
+    std::string const suffix (".gz");
+    std::string name = e.name;
+    if (name.empty ())
+        name = path.size () > suffix.size ()
+            && path.compare (path.size () - suffix.size (), suffix.size (),
+                suffix) == 0 ? path.substr (0, path.size () - suffix.size ())
+            : path;
+    report << " " << name << "\n";
+}
+
+/* list the files, and return the number of the failed ones. an error
+ * takes the place of the file in the listing.
+ */
+int gzlist (std::vector<std::string> const& paths, int nthreads,
+    std::ostream& report)
+{
+    std::vector<list_entry> entries (paths.size ());
+    {
+        thread_pool pool (nthreads);
+        for (std::size_t i = 0; i < paths.size (); ++i)
+            pool.submit ([&, i]{
+                list_entry& e = entries[i];
+                e.compressed = e.uncompressed = e.members = 0;
+                e.crc = e.mtime = 0;
+                try {
+                    list_file (paths[i], e);
+                }
+                catch (std::exception& x) {
+                    e.error = x.what ();
+                }
+            });
+        pool.wait ();
+    }
+    int nfailed = 0;
+    std::uint64_t compressed = 0;
+    std::uint64_t uncompressed = 0;
+    std::ios::fmtflags const flags = report.flags ();
+    report << "  compressed uncompressed   ratio    crc32 members"
+        " modified         name\n";
+    for (std::size_t i = 0; i < paths.size (); ++i) {
+        list_entry const& e = entries[i];
+        if (! e.error.empty ()) {
+            ++nfailed;
+            report << paths[i] << ": FAILED " << e.error << "\n";
+            continue;
+        }
+        put_entry (report, paths[i], e);
+        compressed += e.compressed;
+        uncompressed += e.uncompressed;
+    }
+    if (paths.size () > 1) {
+        put_sizes (report, compressed, uncompressed);
+        report << "(totals)\n";
+    }
+    report.flags (flags);
+    report << std::flush;
+    return nfailed;
+}
+
+}// namespace deflate
@@ -0,0 +1,72 @@
+/* integrity test of compressed files
+ *
+ *  1. decode each file without any output, into the history window
+ *     and the digest only.
+ *  2. test the files concurrently on a thread pool, one file a task.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <fstream>
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+/* report each result, and return the number of the failed files. */
+int gztest (std::vector<std::string> const& paths, int format,
+    int nthreads, std::ostream& report)
+{
+    std::mutex mutex;
+    int nfailed = 0;
+    thread_pool pool (nthreads);
+    for (std::string const& path : paths)
+        pool.submit ([&, path]{
+            std::string result ("OK");
+            try {
+                std::ifstream cin (path, std::ios::in | std::ios::binary);
+                if (! cin)
+                    throw std::runtime_error ("cannot open.");
+                gunzip_stream (cin, nullptr, format, 1);
+            }
+            catch (std::exception& e) {
+                result = std::string ("FAILED ") + e.what ();
+            }
+            std::lock_guard<std::mutex> lock (mutex);
+            if (result != "OK")
+                ++nfailed;
+            report << path << ": " << result << std::endl;
+        });
+    pool.wait ();
+    return nfailed;
+}
+
+}// namespace deflate
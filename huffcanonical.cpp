@@ -36,6 +36,7 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <stdexcept>
 #include "deflate.hpp"
 
 namespace deflate {
@@ -43,8 +44,10 @@ namespace deflate {
 void make_huffman_canonical (std::vector<int> const& hfsize,
     int const limit, std::vector<int>& hfcode)
 {
-    std::vector<int> blcount (limit + 1, 0);
-    std::vector<int> nextcode (limit + 1, 0);
+    int blcount[MAXBITS + 1] = {0};
+    int nextcode[MAXBITS + 1] = {0};
+    if (limit > MAXBITS)
+        throw std::runtime_error ("make_huffman_canonical: too long codes.");
     for (int n : hfsize)
         if (n > 0)
             ++blcount[n];
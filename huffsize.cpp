@@ -1,4 +1,11 @@
 /* Length-limited Huffman coding for Deflate format
+ *
+ * 1. make_huffman_limitedsize gives the optimal lengths under the limit
+ *    by the package-merge algorithm.
+ * 2. make_huffman_fastsize builds a plain Huffman tree by two queues over
+ *    the sorted counts, clamps the lengths to the limit and fixes up the
+ *    Kraft sum, so that the code stays complete. The lengths may cost
+ *    a few bits more than the optimal ones.
  *
  * References:
  *
@@ -36,87 +43,165 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <algorithm>
+#include <stdexcept>
 #include "deflate.hpp"
 
 namespace deflate {
 
-class coin_base {
-public:
-    coin_base (int afreq) : mfreq (afreq) {}
-    virtual ~coin_base () {}
-    virtual void accumulate (std::vector<int>& hfsize) {}
-    virtual int code () const { return 0; }
-    int freq () const { return mfreq; }
-private:
-    int mfreq;
-};
+enum {COINS_MAXSYMBOL = 288, COINS_MAXLIMIT = 15};
 
-class coin : public coin_base {
-public:
-    coin (int afreq, int acode) : coin_base (afreq), mcode (acode) {}
-    virtual int code () const { return mcode; }
-    virtual void accumulate (std::vector<int>& hfsize) { ++hfsize[mcode]; }
-private:
-    int mcode;
+/* a coin is a symbol when second < 0, or a package of the two coins at
+ * first and second in the list of the previous level.
+ */
+struct coin {
+    int freq;
+    int first;
+    int second;
 };
 
-typedef std::shared_ptr<coin_base> coin_ptr;
+static bool coin_less (coin const& a, coin const& b)
+{
+    return a.freq < b.freq;
+}
 
-class pair_coin : public coin_base {
-public:
-    pair_coin (coin_ptr const& c0, coin_ptr const& c1)
-        : coin_base (c0->freq () + c1->freq ()), first (c0), second (c1) {}
+/* the lists of the levels, kept by the thread to make no allocations */
+struct coin_lists {
+    int size[COINS_MAXLIMIT + 1];
+    coin list[COINS_MAXLIMIT + 1][2 * COINS_MAXSYMBOL];
+};
 
-    virtual void accumulate (std::vector<int>& hfsize)
-    {
-        first->accumulate (hfsize);
-        second->accumulate (hfsize);
+static void accumulate (coin_lists const& lists, int level, int i,
+    std::vector<int>& hfsize)
+{
+    coin const& c = lists.list[level][i];
+    if (c.second < 0)
+        ++hfsize[c.first];
+    else {
+        accumulate (lists, level - 1, c.first, hfsize);
+        accumulate (lists, level - 1, c.second, hfsize);
     }
-
-private:
-    coin_ptr const first;
-    coin_ptr const second;
-};
+}
 
 void make_huffman_limitedsize (std::vector<int> const& counts,
     int const nhfsize, int const limit, std::vector<int>& hfsize)
 {
-    struct {
-        bool operator() (coin_ptr a, coin_ptr b)
-        {
-            return a->freq () < b->freq ();
+    static thread_local coin_lists lists;
+    if (counts.size () > COINS_MAXSYMBOL || limit > COINS_MAXLIMIT)
+        throw std::runtime_error ("make_huffman_limitedsize: too many symbols.");
+    hfsize.clear ();
+    hfsize.resize (nhfsize, 0);
+    /* level 0: the symbols in order of their frequencies */
+    coin* freq = lists.list[0];
+    int nfreq = 0;
+    for (std::size_t i = 0; i < counts.size (); ++i)
+        if (counts[i] > 0)
+            freq[nfreq++] = coin {counts[i], static_cast<int> (i), -1};
+    lists.size[0] = nfreq;
+    if (nfreq == 1)
+        hfsize[freq[0].first] = 1;
+    if (nfreq <= 1)
+        return;
+    std::sort (freq, freq + nfreq, coin_less);
+    for (int level = 1; level <= limit; ++level) {
+        coin const* coins = lists.list[level - 1];
+        int const ncoins = lists.size[level - 1];
+        coin pairs[COINS_MAXSYMBOL];
+        int npairs = 0;
+        for (int j = 0; j + 1 < ncoins; j += 2)
+            pairs[npairs++] = coin {coins[j].freq + coins[j + 1].freq, j, j + 1};
+        coin* next = lists.list[level];
+        if (level == limit) {
+            std::copy (pairs, pairs + npairs, next);
+            lists.size[level] = npairs;
+        }
+        else {
+            std::merge (freq, freq + nfreq, pairs, pairs + npairs, next, coin_less);
+            lists.size[level] = nfreq + npairs;
         }
-    } coinptr_less;
+    }
+    for (int i = 0; i < nfreq - 1; ++i)
+        accumulate (lists, limit, i, hfsize);
+}
 
+/* the nodes of the tree by two queues, kept by the thread */
+struct node_queues {
+    coin leaf[COINS_MAXSYMBOL];
+    int weight[2 * COINS_MAXSYMBOL];
+    int parent[2 * COINS_MAXSYMBOL];
+    int depth[2 * COINS_MAXSYMBOL];
+};
+
+void make_huffman_fastsize (std::vector<int> const& counts,
+    int const nhfsize, int const limit, std::vector<int>& hfsize)
+{
+    static thread_local node_queues q;
+    if (counts.size () > COINS_MAXSYMBOL || limit > COINS_MAXLIMIT)
+        throw std::runtime_error ("make_huffman_fastsize: too many symbols.");
     hfsize.clear ();
     hfsize.resize (nhfsize, 0);
-    std::vector<coin_ptr> freq;
+    int n = 0;
     for (std::size_t i = 0; i < counts.size (); ++i)
         if (counts[i] > 0)
-            freq.push_back (std::make_shared<coin> (counts[i], i));
-    if (freq.size () == 1)
-        hfsize[freq[0]->code ()] = 1;
-    else if (freq.size () > 1) {
-        std::sort (freq.begin (), freq.end (), coinptr_less);
-        std::vector<coin_ptr> coins (freq.begin (), freq.end ());
-        for (int i = limit - 1; i >= 0; --i) {
-            std::vector<coin_ptr> pairs;
-            for (std::size_t j = 0; j < coins.size (); j += 2)
-                if (j + 1 < coins.size ())
-                    pairs.push_back (
-                        std::make_shared<pair_coin> (coins[j], coins[j + 1]));
-            if (i == 0)
-                coins.assign (pairs.begin (), pairs.end ());
-            else {
-                coins.resize (freq.size () + pairs.size (), nullptr);
-                std::merge (freq.begin (), freq.end (),
-                            pairs.begin (), pairs.end (),
-                            coins.begin (), coinptr_less);
-            }
+            q.leaf[n++] = coin {counts[i], static_cast<int> (i), -1};
+    if (n == 1)
+        hfsize[q.leaf[0].first] = 1;
+    if (n <= 1)
+        return;
+    std::sort (q.leaf, q.leaf + n, coin_less);
+    /* the leaves are 0 .. n - 1, and the internal nodes n .. 2n - 2 come
+     * out in order of their weights, so the lighter of the two heads is
+     * taken twice for each node.
+     */
+    for (int i = 0; i < n; ++i)
+        q.weight[i] = q.leaf[i].freq;
+    int head = 0;
+    int inner = n;
+    for (int k = n; k < 2 * n - 1; ++k) {
+        q.weight[k] = 0;
+        for (int m = 0; m < 2; ++m) {
+            int const x = head < n && (inner >= k
+                || q.weight[head] <= q.weight[inner]) ? head++ : inner++;
+            q.weight[k] += q.weight[x];
+            q.parent[x] = k;
         }
-        for (std::size_t i = 0; i < freq.size () - 1; ++i)
-            coins[i]->accumulate (hfsize);
     }
+    /* the depths from the root down, clamped to the limit */
+    int blcount[COINS_MAXLIMIT + 1] = {0};
+    q.depth[2 * n - 2] = 0;
+    for (int x = 2 * n - 3; x >= 0; --x)
+        q.depth[x] = q.depth[q.parent[x]] + 1;
+    for (int i = 0; i < n; ++i)
+        ++blcount[std::min (q.depth[i], limit)];
+    /* the Kraft sum in the units of the limit: the clamped leaves make it
+     * over 1. move the leaves of the longest lengths under the limit one
+     * deeper until it is at most 1, then lift the deepest leaves into the
+     * slack left, which stays a multiple of their unit, until it is 1.
+     */
+    long const one = 1L << limit;
+    long kraft = 0;
+    for (int len = 1; len <= limit; ++len)
+        kraft += static_cast<long> (blcount[len]) << (limit - len);
+    while (kraft > one) {
+        int len = limit - 1;
+        while (blcount[len] == 0)
+            --len;
+        --blcount[len];
+        ++blcount[len + 1];
+        kraft -= 1L << (limit - len - 1);
+    }
+    while (kraft < one) {
+        int len = limit;
+        while (blcount[len] == 0)
+            --len;
+        --blcount[len];
+        ++blcount[len - 1];
+        kraft += 1L << (limit - len);
+    }
+    /* the rarest symbols take the longest lengths */
+    int i = 0;
+    for (int len = limit; len >= 1; --len)
+        for (int c = 0; c < blcount[len]; ++c)
+            hfsize[q.leaf[i++].first] = len;
 }
 
 }// namespace deflate
@@ -29,6 +29,7 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <stdexcept>
 #include "deflate.hpp"
 
 namespace deflate {
@@ -55,5 +56,29 @@ void make_huffman_tree (std::vector<int> const& hfsize,
     hftree = tree;
 }
 
+/* count the codes of each length, and sort the symbols in the order of
+ * their canonical codes: by length, then by symbol. an over-subscribed
+ * set of lengths is an error, while an incomplete one is allowed.
+ */
+void huffman_table::build (int const* lengths, int n)
+{
+    std::uint16_t offset[MAXBITS + 1];
+    std::fill (count, count + MAXBITS + 1, 0);
+    for (int i = 0; i < n; ++i)
+        ++count[lengths[i]];
+    int left = 1;
+    for (int bits = 1; bits <= MAXBITS; ++bits) {
+        left = (left << 1) - count[bits];
+        if (left < 0)
+            throw std::runtime_error ("huffman_table: over-subscribed code lengths.");
+    }
+    offset[1] = 0;
+    for (int bits = 1; bits < MAXBITS; ++bits)
+        offset[bits + 1] = offset[bits] + count[bits];
+    for (int i = 0; i < n; ++i)
+        if (lengths[i] != 0)
+            symbol[offset[lengths[i]]++] = i;
+}
+
 }// namespace deflate
 
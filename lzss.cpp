@@ -5,6 +5,16 @@
  *  3. a ring buffer to slide a window of strings.
  *  4. a ring buffer to slide a window of chains of hash table.
  *  5. one byte after lazy matching.
+ *  6. the digest and the output sink take the ring buffer in chunks
+ *     as it wraps around.
+ *  7. the sizes of the window and the hash table are the template
+ *     parameters, instantiated for the default and the small profiles.
+ *     the chains take a slot a byte of the window, not of the buffer.
+ *  8. a link of the chains carries a tag of the bytes at its position,
+ *     and the walk prefetches the next link, so that most candidates are
+ *     rejected without a cache miss in the window.
+ *  9. the chains keep 16 bits a link: the distance to the previous one,
+ *     and the heads an offset over a base, which slides a window at a time.
  *
  * References:
  *
@@ -42,91 +52,277 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
 #include "deflate.hpp"
 
 namespace deflate {
 
-void lzss_compression::decompress_literal (std::ostream& cout, int const c)
+static inline void prefetch (void const* p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch (p);
+#else
+    (void) p;
+#endif
+}
+
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::decompress_literal (int const c)
 {
-    cout.put (c);
     put (c);            /* put byte into the ring buffer */
 }
 
-void lzss_compression::decompress_length_distance (
-    std::ostream& cout, int const n, int const d)
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::decompress_length_distance (
+    int const n, int const d)
 {
     int i = msize - d;
     for (int j = 0; j < n; ++j) {
         int c = buf[i % BUFSIZE];
         ++i;
-        cout.put (c);
         put (c);        /* put it into the ring buffer */
     }
 }
 
-int lzss_compression::compress (
-    std::istream& cin, huffman_encoder& huffman)
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::compress_begin (
+    huffman_encoder& huffman)
 {
-    int c, len, dist;
+    reset ();
+    if (top.empty ()) {
+        /* the decoder has no use of the tables */
+        top.assign (HASHSIZE, 0);
+        idx.assign (WINSIZE, chain_link {0, 0});
+        hbase = msize - WINSIZE;
+    }
+    huffman.start_block ();
+}
 
-    /* longest_match ignores WINSIZEs bytes far strings. */
-    std::fill (top.begin (), top.end (), -WINSIZE);
-    std::fill (idx.begin (), idx.end (), -WINSIZE);
-    /* fill the ring buffer for first longest_match and lazy it. */
-    msize = 0;
-    for (int i = 0; i < DATASIZE + 1; ++i) {
-        c = cin.get ();
-        if (c == EOF)
+/* take input bytes into the ring buffer, and encode strings as long as
+ * they have the lookahead for the longest_match and lazy it.
+ * the ring buffer keeps WINSIZE bytes behind the current position.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+std::size_t lzss_window<WBITS, HBITS, BLOCKLIMIT>::compress_feed (
+    std::uint8_t const* p,
+    std::size_t n, huffman_encoder& huffman)
+{
+    std::size_t used = 0;
+    for (;;) {
+        {
+            stats_timer timer (stats, &stream_stats::match_ns);
+            while (msize >= mcur + DATASIZE + 2)
+                compress_step (huffman);
+        }
+        if (used == n)
             break;
-        put (c);
+        std::size_t room = mcur + (BUFSIZE - WINSIZE) - msize;
+        for (std::size_t m = std::min (room, n - used); m > 0; --m)
+            put (p[used++]);
+    }
+    return used;
+}
+
+/* end the block at the last byte fed, and byte-align the output with an
+ * empty stored block, so that a decoder can take all bytes so far. a full
+ * flush forgets the history: the heads of the chains become none, and
+ * the chains from the later positions end at them.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::compress_flush (
+    huffman_encoder& huffman, bool full)
+{
+    {
+        stats_timer timer (stats, &stream_stats::match_ns);
+        while (mcur < msize)
+            compress_step (huffman);
     }
+    huffman.end_block (false);
+    huffman.put_empty_stored_block ();
+    if (full)
+        std::fill (top.begin (), top.end (), 0);
     huffman.start_block ();
-    for (int cur = 0; cur < msize;) {
-        int lenlazy, distlazy;
-        bool m = longest_match (cur, len, dist);
-        bool mlazy = false;
-        if (m)
-            mlazy = longest_match (cur + 1, lenlazy, distlazy);
-        int match_offset = 2;
-        if (! m || (mlazy && len < lenlazy)) {
-            /* output one byte and push new one. */
-            c = buf[cur % BUFSIZE];
-            ++cur;
-            huffman.put_literal (c);
-            c = cin.get ();
-            if (c != EOF)
-                put (c);
-            if (! m)
-                continue;
-            /* use lazy matching strings */
-            m = mlazy;
-            len = lenlazy;
-            dist = distlazy;
-            match_offset = 1;
-        }
-        huffman.put_length_distance (len, dist);
-        for (int i = match_offset; i < len; ++i)
-            index_3gram (cur + i);
-        for (int i = 0; i < len; ++i) {
-            c = cin.get ();
-            if (c == EOF)
-                break;
-            put (c);
-        }
-        cur += len;
+}
+
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+int lzss_window<WBITS, HBITS, BLOCKLIMIT>::compress_finish (
+    huffman_encoder& huffman)
+{
+    {
+        stats_timer timer (stats, &stream_stats::match_ns);
+        while (mcur < msize)
+            compress_step (huffman);
     }
     huffman.end_block ();
-    return msize;
+    sync ();
+    return msize - mbase;
+}
+
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+int lzss_window<WBITS, HBITS, BLOCKLIMIT>::compress (
+    std::istream& cin, huffman_encoder& huffman)
+{
+    std::vector<char> chunk (BUFSIZE - WINSIZE);
+    compress_begin (huffman);
+    for (;;) {
+        cin.read (&chunk[0], chunk.size ());
+        std::size_t n = cin.gcount ();
+        if (n == 0)
+            break;
+        compress_feed (reinterpret_cast<std::uint8_t const*> (&chunk[0]),
+            n, huffman);
+    }
+    return compress_finish (huffman);
+}
+
+/* encode a literal or a length-distance pair at the current position.
+ * the matching looks ahead DATASIZE + 1 bytes at most as the limit.
+ * with BLOCKLIMIT, a block ends before its codes run over the limit,
+ * so that the code list never grows past it.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::compress_step (
+    huffman_encoder& huffman)
+{
+    int len, dist, lenlazy, distlazy;
+    if (BLOCKLIMIT > 0 && huffman.codes () + 4 > BLOCKLIMIT) {
+        huffman.end_block (false);
+        huffman.start_block ();
+    }
+    mlimit = std::min (msize, mcur + DATASIZE + 1);
+    bool m = longest_match (mcur, len, dist);
+    bool mlazy = false;
+    if (m)
+        mlazy = longest_match (mcur + 1, lenlazy, distlazy);
+    if (stats != nullptr && m) {
+        ++stats->lazy_tries;
+        if (mlazy && len < lenlazy)
+            ++stats->lazy_hits;
+    }
+    int match_offset = 2;
+    if (! m || (mlazy && len < lenlazy)) {
+        /* output one byte and slide the limit. */
+        huffman.put_literal (buf[mcur % BUFSIZE]);
+        ++mcur;
+        mlimit = std::min (msize, mcur + DATASIZE + 1);
+        if (! m)
+            return;
+        /* use lazy matching strings */
+        len = lenlazy;
+        dist = distlazy;
+        match_offset = 1;
+    }
+    huffman.put_length_distance (len, dist);
+    for (int i = match_offset; i < len; ++i)
+        index_3gram (mcur + i);
+    mcur += len;
 }
 
-void lzss_compression::put (int const c)
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::put (int const c)
 {
     buf[msize % BUFSIZE] = c;
     ++msize;
-    digest->put (c);    /* CRC32 or Adler-32 */
+    if (msize % BUFSIZE == 0 && ! hold)
+        sync ();
 }
 
-int lzss_compression::index_3gram (int const cur)
+/* start a new stream in O(1). the positions go on a window ahead, and
+ * longest_match ignores WINSIZEs bytes far strings, so that the chains
+ * never reach the last stream. the tables are filled again only before
+ * the positions overflow.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::reset ()
+{
+    if (msize < REBASE)
+        msize += WINSIZE;
+    else {
+        std::fill (top.begin (), top.end (), 0);
+        std::fill (idx.begin (), idx.end (), chain_link {0, 0});
+        msize = 0;
+        hbase = -WINSIZE;
+    }
+    mbase = msync = mcur = mlimit = msize;
+    digest->clear ();
+}
+
+/* the push mode holds decoded bytes in the ring buffer until the caller
+ * takes them, feeding the digest with them. held gives the bytes in place
+ * up to the end of the ring buffer, and release takes n of them.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+std::size_t lzss_window<WBITS, HBITS, BLOCKLIMIT>::held (
+    std::uint8_t const*& p) const
+{
+    int const pos = msync % BUFSIZE;
+    p = &buf[pos];
+    return std::min (msize - msync, BUFSIZE - pos);
+}
+
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::release (std::size_t n)
+{
+    if (n == 0)
+        return;
+    {
+        stats_timer timer (stats, &stream_stats::digest_ns);
+        digest->update (&buf[msync % BUFSIZE], n);
+    }
+    msync += n;
+}
+
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+std::size_t lzss_window<WBITS, HBITS, BLOCKLIMIT>::drain (
+    std::uint8_t* p, std::size_t n)
+{
+    std::size_t done = 0;
+    std::uint8_t const* q;
+    while (done < n) {
+        std::size_t const m = std::min (held (q), n - done);
+        if (m == 0)
+            break;
+        std::copy (q, q + m, p + done);
+        release (m);
+        done += m;
+    }
+    return done;
+}
+
+/* feed bytes after the last sync into the digest: CRC32 or Adler-32,
+ * and into the sink if any.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::sync ()
+{
+    while (msync < msize) {
+        int const pos = msync % BUFSIZE;
+        int const n = std::min (msize - msync, BUFSIZE - pos);
+        char const* p = reinterpret_cast<char const*> (&buf[pos]);
+        {
+            stats_timer timer (stats, &stream_stats::digest_ns);
+            digest->update (&buf[pos], n);
+        }
+        if (sink != nullptr)
+            sink->write (p, n);
+        msync += n;
+    }
+}
+
+/* the heads are the positions over hbase in 16 bits. as the positions
+ * run past two windows over it, the base slides a window, and the heads
+ * which fall under it become 0, as they are out of the window.
+ */
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+void lzss_window<WBITS, HBITS, BLOCKLIMIT>::rebase ()
+{
+    hbase += WINSIZE;
+    for (auto& v : top)
+        v = v > WINSIZE ? v - WINSIZE : 0;
+}
+
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+int lzss_window<WBITS, HBITS, BLOCKLIMIT>::index_3gram (int const cur)
 {
     /* D. Knuth, `The Art of Computer Programming Vol.3' 1998, page 516-519
      *    6.4 multiplicative hashing
@@ -142,43 +338,80 @@ int lzss_compression::index_3gram (int const cur)
      *      1/3 <     static_cast<double>(0x6d) / (1 << 8)  < 3/7
      */
     const static std::uint32_t HASHFRAC = 0x009e416dL;
-    if (cur + 3 >= msize)
+    if (cur + 3 >= mlimit)
         return -WINSIZE;
     uint32_t const k
         = (static_cast<uint32_t> (buf[ cur      % BUFSIZE]) << 16)
         | (static_cast<uint32_t> (buf[(cur + 1) % BUFSIZE]) << 8)
         |  static_cast<uint32_t> (buf[(cur + 2) % BUFSIZE]);
-    uint32_t const h = ((k * HASHFRAC) & 0x00ffffffL) >> (24 - HASHLOG2);
+    uint32_t const m = (k * HASHFRAC) & 0x00ffffffL;
+    uint32_t const h = m >> (24 - HASHLOG2);
+    /* HASHFRAC is odd, so that m is one to one with k. the low KEYBITS
+     * of m tell the 3 bytes in the chain of h, and the rest of the tag
+     * takes the low bits of the 4th byte.
+     */
+    std::uint16_t const tag = (m & ((1L << KEYBITS) - 1))
+        | (static_cast<uint32_t> (buf[(cur + 3) % BUFSIZE]) << KEYBITS);
+    while (cur - hbase >= 2 * WINSIZE)
+        rebase ();
     /* push location into the chain of the hash table */
-    int prev = top[h];
-    idx[cur % BUFSIZE] = prev;
-    top[h] = cur;
+    int const prev = top[h] > 0 ? hbase + top[h] : cur - WINSIZE;
+    int const dist = cur - prev < WINSIZE ? cur - prev : 0;
+    idx[cur % WINSIZE] = chain_link {static_cast<std::uint16_t> (dist), tag};
+    top[h] = cur - hbase;
     return prev;
 }
 
-bool lzss_compression::longest_match (int const cur, int& len, int& dist)
+template <int WBITS, int HBITS, int BLOCKLIMIT>
+bool lzss_window<WBITS, HBITS, BLOCKLIMIT>::longest_match (
+    int const cur, int& len, int& dist)
 {
-    if (cur + THRESHOLD >= msize)
+    if (cur + THRESHOLD >= mlimit)
         return false;
     int longest_pos = cur;
     int longest_size = 0;
-    /* search sub-strings in the location chains of the hash table */
+    /* search sub-strings in the location chains of the hash table.
+     * the tags tell the first three bytes and a part of the 4th, and the
+     * window is read only past them. the link after the next is fetched
+     * ahead meanwhile.
+     */
     int pos = index_3gram (cur);
+    std::uint16_t const tag = idx[cur % WINSIZE].tag;
+    int walked = 0;
     while (cur - pos < WINSIZE) {
+        ++walked;
+        chain_link const link = idx[pos % WINSIZE];
+        int const next = link.dist > 0 ? pos - link.dist : pos - WINSIZE;
+        prefetch (&idx[next & (WINSIZE - 1)]);
+        std::uint16_t const diff = link.tag ^ tag;
         int n = 0;
-        for (; n < DATASIZE && cur + n < msize; ++n)
-            if (buf[(pos + n) % BUFSIZE] != buf[(cur + n) % BUFSIZE])
-                break;
+        if ((diff & ((1L << KEYBITS) - 1)) != 0)
+            n = 0;
+        else if (diff != 0)
+            n = 3;
+        else
+            for (n = 3; n < DATASIZE && cur + n < mlimit; ++n)
+                if (buf[(pos + n) % BUFSIZE] != buf[(cur + n) % BUFSIZE])
+                    break;
         if (n >= THRESHOLD && n > longest_size) {
             longest_pos = pos;
             longest_size = n;
         }
-        pos = idx[pos % BUFSIZE];
+        pos = next;
+    }
+    if (stats != nullptr) {
+        ++stats->searches;
+        stats->candidates += walked;
+        stats->max_candidates = std::max (stats->max_candidates,
+            static_cast<std::uint64_t> (walked));
     }
     len = longest_size;
     dist = cur - longest_pos;
     return len > 0;
 }
 
+template class lzss_window<15, 13, 131072>;
+template class lzss_window<12, 10, 2048>;
+
 }// namespace deflate
 
@@ -29,18 +29,187 @@
  * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <string>
+#include <stdexcept>
 #include "deflate.hpp"
 
+static void usage ()
+{
+    std::cerr << "usage: cxxgzip [-z|-r] [-p threads] [-T ms] [-N bytes] [-F] [-m] [--rsyncable] [--stats] < input > output.gz\n"
+                 "       cxxgzip -b [-p threads] < input > output.gz\n"
+                 "       cxxgzip -d [-z|-r] [-p threads] [-s voffset] [--stats] < input.gz > output\n"
+                 "       cxxgzip [-d] [-b|-z|-r] [-p threads] [-R] [-U] [-f list] file...\n"
+                 "       cxxgzip -t [-z|-r] [-p threads] file...\n"
+                 "       cxxgzip -l [-p threads] [-R] [-f list] file...\n"
+                 "       cxxgzip --grep pattern... [--regex] [--byte-offset] [--max-count n] [-z|-r] [-R] [-f list] [file...]\n";
+    std::exit (EXIT_FAILURE);
+}
+
 int main (int argc, char* argv[])
 {
-    std::string opt;
+    bool decompress = false;
+    bool test = false;
+    bool list = false;
+    bool seek = false;
+    bool recursive = false;
+    bool uring = false;
+    bool stats = false;
+    bool grep = false;
+    deflate::grep_options grep_options;
+    int profile = deflate::PROFILE_DEFAULT;
+    deflate::flush_policy policy;
+    int format = deflate::FORMAT_GZIP;
+    int nthreads = 1;
+    std::uint64_t voffset = 0;
+    std::vector<std::string> args;
+    std::vector<std::string> lists;
 
-    if (argc >= 2)
-        opt.assign (argv[1]);
-    if (opt == "-d")
-        deflate::gunzip ();
-    else
-        deflate::gzip ();
+    for (int i = 1; i < argc; ++i) {
+        std::string opt (argv[i]);
+        if (opt == "-d")
+            decompress = true;
+        else if (opt == "-t")
+            test = true;
+        else if (opt == "-l")
+            list = true;
+        else if (opt == "-b")
+            format = deflate::FORMAT_BGZF;
+        else if (opt == "-z")
+            format = deflate::FORMAT_ZLIB;
+        else if (opt == "-r")
+            format = deflate::FORMAT_RAW;
+        else if (opt == "-T" && i + 1 < argc)
+            policy.milliseconds = std::atoi (argv[++i]);
+        else if (opt == "-N" && i + 1 < argc)
+            policy.bytes = std::strtoull (argv[++i], nullptr, 0);
+        else if (opt == "-F")
+            policy.mode = deflate::STREAM_FULL_FLUSH;
+        else if (opt == "--rsyncable")
+            policy.rsyncable = true;
+        else if (opt == "-m")
+            profile = deflate::PROFILE_SMALL;
+        else if (opt == "-U")
+            uring = true;
+        else if (opt == "--stats")
+            stats = true;
+        else if (opt == "--grep" && i + 1 < argc) {
+            /* a newline separates the patterns, as grep */
+            grep = true;
+            std::string const patterns (argv[++i]);
+            for (std::size_t b = 0, e; b <= patterns.size (); b = e + 1) {
+                e = std::min (patterns.find ('\n', b), patterns.size ());
+                grep_options.patterns.push_back (patterns.substr (b, e - b));
+            }
+        }
+        else if (opt == "--regex")
+            grep_options.regex = true;
+        else if (opt == "--byte-offset")
+            grep_options.offsets = true;
+        else if (opt == "--max-count" && i + 1 < argc)
+            grep_options.max_count = std::strtoull (argv[++i], nullptr, 0);
+        else if (opt == "-R")
+            recursive = true;
+        else if (opt == "-f" && i + 1 < argc)
+            lists.push_back (argv[++i]);
+        else if (opt == "-p" && i + 1 < argc)
+            nthreads = std::atoi (argv[++i]);
+        else if (opt == "-s" && i + 1 < argc) {
+            seek = true;
+            voffset = std::strtoull (argv[++i], nullptr, 0);
+        }
+        else if (! opt.empty () && opt[0] != '-')
+            args.push_back (opt);
+        else
+            usage ();
+    }
+    /* a file name a line in the list files, or stdin with "-" */
+    for (std::string const& list : lists) {
+        std::ifstream file;
+        if (list != "-") {
+            file.open (list);
+            if (! file) {
+                std::cerr << "cppgzip: " << list << ": cannot open." << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        std::istream& cin = list == "-" ? std::cin : file;
+        for (std::string line; std::getline (cin, line);)
+            if (! line.empty ())
+                args.push_back (line);
+    }
+    std::vector<std::string> files;
+    for (std::string const& path : args)
+        deflate::collect_files (path, recursive,
+            decompress || test || list || grep, format, files);
+    if (! files.empty () && seek)
+        usage ();
+    /* the listing takes the gzip and BGZF files only */
+    if (list && (decompress || test || seek || stats || uring
+            || format == deflate::FORMAT_ZLIB || format == deflate::FORMAT_RAW))
+        usage ();
+    bool const flushing = policy.milliseconds > 0 || policy.bytes > 0
+        || policy.mode != deflate::STREAM_SYNC_FLUSH;
+    /* the search takes the compressed files or stdin */
+    if ((grep && (decompress || test || list || seek || stats || uring
+            || profile != deflate::PROFILE_DEFAULT || policy.rsyncable
+            || flushing))
+            || (! grep && (grep_options.regex || grep_options.offsets
+            || grep_options.max_count > 0)))
+        usage ();
+    /* the statistics of the stream from stdin */
+    if (stats && (! files.empty () || ! lists.empty () || test || seek
+            || (format == deflate::FORMAT_BGZF && ! decompress)))
+        usage ();
+    /* the small profile, the rsyncable mode and the flushes compress
+     * the stream from stdin.
+     */
+    if ((profile != deflate::PROFILE_DEFAULT || policy.rsyncable || flushing)
+            && (decompress || test || seek
+            || ! files.empty () || ! lists.empty ()
+            || format == deflate::FORMAT_BGZF))
+        usage ();
+    deflate::stream_stats counters;
+    if (files.empty () && ! lists.empty ())
+        return EXIT_SUCCESS;
+    if (nthreads < 1)
+        nthreads = std::max (1U, std::thread::hardware_concurrency ());
+    try {
+        if (grep)
+            return deflate::gzgrep (files, format, grep_options,
+                std::cout, std::cerr);
+        if (list) {
+            if (files.empty ())
+                usage ();
+            if (deflate::gzlist (files, nthreads, std::cout) > 0)
+                return EXIT_FAILURE;
+        }
+        else if (test) {
+            if (files.empty ())
+                usage ();
+            if (deflate::gztest (files, format, nthreads, std::cout) > 0)
+                return EXIT_FAILURE;
+        }
+        else if (! files.empty ()) {
+            auto batch = uring ? deflate::gzip_batch_uring : deflate::gzip_batch;
+            if (batch (files, decompress, format, nthreads, std::cerr) > 0)
+                return EXIT_FAILURE;
+        }
+        else if (seek)
+            deflate::bgzf_seek (voffset, nthreads);
+        else if (decompress)
+            deflate::gunzip (format, nthreads, stats ? &counters : nullptr);
+        else
+            deflate::gzip (format, nthreads, policy,
+                stats ? &counters : nullptr, profile);
+        if (stats)
+            counters.report (std::cerr);
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what () << std::endl;
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
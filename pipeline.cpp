@@ -0,0 +1,250 @@
+/* three-stage pipeline of reading, compression and writing
+ *
+ *  1. a reader thread fills large input buffers from the descriptor,
+ *     taking whatever read(2) returns, and a writer thread drains the
+ *     compressed buffers.
+ *  2. the buffers go round between the stages through lock-free SPSC
+ *     queues of the full and of the free ones, so that a fixed number
+ *     of buffers are in flight.
+ *  3. the compressor waits only when the reader has nothing yet, or
+ *     the writer holds all the output buffers.
+ *  4. the flush policy ends the block and hands the partial output
+ *     buffer to the writer, after a count of input bytes, or when the
+ *     input has waited for the interval since its first byte.
+ *  5. on an error, the reader stops at once, woken from poll(2) by a
+ *     byte on a pipe of its own, rather than read an endless input to
+ *     its end.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <poll.h>
+#include <unistd.h>
+#include "deflate.hpp"
+
+namespace deflate {
+
+enum {PIPEBUFSIZE = 1024 * 1024, PIPEDEPTH = 4};
+
+struct pipe_buffer {
+    std::vector<std::uint8_t> data;
+    std::size_t size;
+};
+
+/* nullptr in a full queue marks the end of the stream. */
+void gzip_pipeline (int format, int infd, int outfd,
+    flush_policy const& policy, stream_stats* stats, int profile,
+    int nthreads)
+{
+    std::vector<pipe_buffer> inbufs (PIPEDEPTH);
+    std::vector<pipe_buffer> outbufs (PIPEDEPTH);
+    spsc_queue<pipe_buffer*> infree (PIPEDEPTH + 1);
+    spsc_queue<pipe_buffer*> infull (PIPEDEPTH + 1);
+    spsc_queue<pipe_buffer*> outfree (PIPEDEPTH + 1);
+    spsc_queue<pipe_buffer*> outfull (PIPEDEPTH + 1);
+    for (int i = 0; i < PIPEDEPTH; ++i) {
+        inbufs[i].data.resize (PIPEBUFSIZE);
+        outbufs[i].data.resize (PIPEBUFSIZE);
+        infree.push (&inbufs[i]);
+        outfree.push (&outbufs[i]);
+    }
+    int read_errno = 0;
+    int write_errno = 0;
+    std::atomic<bool> write_failed (false);
+    std::atomic<bool> stopping (false);
+    int stopfd[2];
+    if (::pipe (stopfd) < 0)
+        throw std::runtime_error ("cppgzip: pipe: "
+            + std::string (std::strerror (errno)));
+
+    std::thread reader ([&]{
+        for (;;) {
+            pipe_buffer* b = infree.pop ();
+            /* the stop pipe stays readable once written */
+            struct pollfd fds[2] = {{infd, POLLIN, 0}, {stopfd[0], POLLIN, 0}};
+            ssize_t n = -1;
+            for (;;) {
+                if (::poll (fds, 2, -1) < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    break;
+                }
+                if (fds[1].revents != 0)
+                    break;
+                do
+                    n = ::read (infd, &b->data[0], b->data.size ());
+                while (n < 0 && errno == EINTR);
+                break;
+            }
+            if (stopping) {
+                infull.push (nullptr);
+                return;
+            }
+            if (n <= 0) {
+                if (n < 0)
+                    read_errno = errno;
+                infull.push (nullptr);
+                return;
+            }
+            b->size = n;
+            infull.push (b);
+        }
+    });
+    std::thread writer ([&]{
+        for (;;) {
+            pipe_buffer* b = outfull.pop ();
+            if (b == nullptr)
+                return;
+            for (std::size_t done = 0; ! write_failed && done < b->size;) {
+                ssize_t const n = ::write (outfd, &b->data[done], b->size - done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0) {
+                    write_errno = errno;
+                    write_failed = true;
+                    break;
+                }
+                done += n;
+            }
+            outfree.push (b);
+        }
+    });
+
+    bool input_end = false;
+    std::exception_ptr error = nullptr;
+    try {
+        std::unique_ptr<deflate_stream_base> const stream
+            = make_deflate_stream (format, profile);
+        deflate_stream_base& z = *stream;
+        z.set_stats (stats);
+        z.set_rsyncable (policy.rsyncable);
+        /* the blocks are encoded while the next is matched */
+        z.set_encoder_thread (nthreads > 1);
+        pipe_buffer* out = outfree.pop ();
+        std::size_t used = 0;
+        std::size_t unflushed = 0;
+        std::chrono::steady_clock::time_point deadline;
+        auto ship = [&]{
+            out->size = used;
+            outfull.push (out);
+            out = outfree.pop ();
+            used = 0;
+            if (write_failed)
+                throw std::runtime_error ("cppgzip: write: "
+                    + std::string (std::strerror (write_errno)));
+        };
+        auto run = [&](std::uint8_t const* next_in, std::size_t avail_in,
+                int flush) {
+            for (;;) {
+                std::uint8_t* next_out = &out->data[used];
+                std::size_t avail_out = out->data.size () - used;
+                int const r = z.compress (next_in, avail_in,
+                    next_out, avail_out, flush);
+                used = out->data.size () - avail_out;
+                if (r != STREAM_OUTPUT_FULL)
+                    return;
+                ship ();
+            }
+        };
+        auto flush = [&]{
+            run (nullptr, 0, policy.mode);
+            if (used > 0)
+                ship ();
+            unflushed = 0;
+        };
+        for (;;) {
+            pipe_buffer* in;
+            if (policy.milliseconds > 0 && unflushed > 0) {
+                if (! infull.pop_until (in, deadline)) {
+                    flush ();
+                    continue;
+                }
+            }
+            else
+                in = infull.pop ();
+            input_end = in == nullptr;
+            if (input_end)
+                break;
+            std::uint8_t const* p = &in->data[0];
+            for (std::size_t n = in->size; n > 0;) {
+                std::size_t m = n;
+                if (policy.bytes > 0)
+                    m = std::min (m, policy.bytes - unflushed);
+                if (unflushed == 0)
+                    deadline = std::chrono::steady_clock::now ()
+                        + std::chrono::milliseconds (policy.milliseconds);
+                run (p, m, STREAM_NO_FLUSH);
+                p += m;
+                n -= m;
+                unflushed += m;
+                if (policy.bytes > 0 && unflushed >= policy.bytes)
+                    flush ();
+            }
+            infree.push (in);
+        }
+        run (nullptr, 0, STREAM_FINISH);
+        out->size = used;
+        outfull.push (out);
+    }
+    catch (...) {
+        error = std::current_exception ();
+        /* stop the reader, and give it the buffers until it ends */
+        stopping = true;
+        char const one = 1;
+        ssize_t const r = ::write (stopfd[1], &one, 1);
+        (void) r;
+        while (! input_end) {
+            pipe_buffer* in = infull.pop ();
+            input_end = in == nullptr;
+            if (! input_end)
+                infree.push (in);
+        }
+    }
+    outfull.push (nullptr);
+    reader.join ();
+    writer.join ();
+    ::close (stopfd[0]);
+    ::close (stopfd[1]);
+    if (error != nullptr)
+        std::rethrow_exception (error);
+    if (read_errno != 0)
+        throw std::runtime_error ("cppgzip: read: "
+            + std::string (std::strerror (read_errno)));
+    if (write_failed)
+        throw std::runtime_error ("cppgzip: write: "
+            + std::string (std::strerror (write_errno)));
+}
+
+}// namespace deflate
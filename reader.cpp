@@ -0,0 +1,94 @@
+/* pull mode decompression in place
+ *
+ *  1. the reader pulls the compressed data from an input stream into
+ *     a buffer of its own, or takes a span of it in memory.
+ *  2. each chunk is a span of the ring buffer of the decoder, so that
+ *     the caller reads the decompressed bytes with no copy.
+ *  3. the decoder runs at most a chunk ahead of the caller: taking the
+ *     span back is the backpressure, and the memory stays bounded by
+ *     the ring buffer.
+ *  4. concatenated gzip members go on as one stream of chunks.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+inflate_reader::inflate_reader (std::istream& acin, int aformat,
+    std::size_t chunk)
+    : cin (&acin), format (aformat), stream (aformat), ibuf (IBUFSIZE),
+      next_in (nullptr), avail_in (0)
+{
+    stream.set_chunk (chunk);
+}
+
+inflate_reader::inflate_reader (std::uint8_t const* p, std::size_t n,
+    int aformat, std::size_t chunk)
+    : cin (nullptr), format (aformat), stream (aformat), ibuf (),
+      next_in (p), avail_in (n)
+{
+    stream.set_chunk (chunk);
+}
+
+bool inflate_reader::refill ()
+{
+    if (cin == nullptr)
+        return false;
+    cin->read (reinterpret_cast<char*> (&ibuf[0]), ibuf.size ());
+    next_in = &ibuf[0];
+    avail_in = cin->gcount ();
+    return avail_in > 0;
+}
+
+/* the next span of the decompressed bytes, or 0 at the end of the data */
+std::size_t inflate_reader::next_chunk (std::uint8_t const*& p)
+{
+    for (;;) {
+        std::size_t n;
+        int const r = stream.decompress_span (next_in, avail_in, p, n);
+        if (n > 0)
+            return n;
+        if (r == STREAM_END) {
+            if (format == FORMAT_ZLIB || format == FORMAT_RAW)
+                return 0;
+            /* the next member, if any */
+            if (avail_in == 0 && ! refill ())
+                return 0;
+        }
+        else if (r == STREAM_NEED_INPUT && ! refill ())
+            throw std::runtime_error ("inflate_reader: unexpected end-of-file.");
+    }
+}
+
+}// namespace deflate
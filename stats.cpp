@@ -0,0 +1,172 @@
+/* statistics of the compression and the decompression streams
+ *
+ *  1. the encoder records each block at its end: the type chosen, the
+ *     sizes of the tables, and the histograms of the length and the
+ *     distance codes.
+ *  2. the matcher counts the chain entries walked in longest_match, and
+ *     how often the lazy match at the next byte wins.
+ *  3. the stages add their times: match finding, table build, bit output,
+ *     the digest, and the decoding.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <iomanip>
+#include "deflate.hpp"
+
+namespace deflate {
+
+void stream_stats::clear ()
+{
+    input = output = 0;
+    std::fill (lengths, lengths + 29, 0);
+    std::fill (distances, distances + 30, 0);
+    searches = candidates = max_candidates = 0;
+    lazy_tries = lazy_hits = 0;
+    match_ns = table_ns = output_ns = digest_ns = decode_ns = 0;
+    blocks.clear ();
+}
+
+/* add the counters of a part of the stream, such as a BGZF block,
+ * decoded on its own
+ */
+void stream_stats::merge (stream_stats const& s)
+{
+    input += s.input;
+    output += s.output;
+    for (int i = 0; i < 29; ++i)
+        lengths[i] += s.lengths[i];
+    for (int i = 0; i < 30; ++i)
+        distances[i] += s.distances[i];
+    searches += s.searches;
+    candidates += s.candidates;
+    max_candidates = std::max (max_candidates, s.max_candidates);
+    lazy_tries += s.lazy_tries;
+    lazy_hits += s.lazy_hits;
+    match_ns += s.match_ns;
+    table_ns += s.table_ns;
+    output_ns += s.output_ns;
+    digest_ns += s.digest_ns;
+    decode_ns += s.decode_ns;
+    blocks.insert (blocks.end (), s.blocks.begin (), s.blocks.end ());
+}
+
+/* the sums of the blocks */
+block_stats stream_stats::total () const
+{
+    block_stats t = {0, false, 0, 0, 0, 0, 0, 0, 0, 0};
+    for (block_stats const& b : blocks) {
+        t.bytes += b.bytes;
+        t.literals += b.literals;
+        t.matches += b.matches;
+        t.bits += b.bits;
+        t.table_bits += b.table_bits;
+    }
+    return t;
+}
+
+static char const* block_type_name (int const type)
+{
+    return type == 0 ? "stored" : type == 1 ? "fixed" : "dynamic";
+}
+
+static double ms (std::uint64_t const ns)
+{
+    return ns / 1e6;
+}
+
+static void report_histogram (std::ostream& out, char const* name,
+    std::uint64_t const* counts, int n, int first)
+{
+    out << name << ":";
+    for (int i = 0; i < n; ++i)
+        if (counts[i] > 0)
+            out << " " << first + i << ":" << counts[i];
+    out << "\n";
+}
+
+void stream_stats::report (std::ostream& out) const
+{
+    block_stats const t = total ();
+    std::uint64_t types[3] = {0, 0, 0};
+    for (block_stats const& b : blocks)
+        if (b.type >= 0 && b.type < 3)
+            ++types[b.type];
+    std::ios::fmtflags const flags = out.flags ();
+    out << std::fixed << std::setprecision (3);
+    out << "stream:";
+    if (input > 0)
+        out << " input " << input;
+    out << " output " << output << " bytes " << t.bytes << "\n";
+    out << "blocks: " << blocks.size () << " (stored " << types[0]
+        << ", fixed " << types[1] << ", dynamic " << types[2] << ")\n";
+    out << "symbols: literals " << t.literals << " matches " << t.matches;
+    if (t.matches > 0)
+        out << " average length "
+            << static_cast<double> (t.bytes - t.literals) / t.matches;
+    out << "\n";
+    if (searches > 0)
+        out << "chains: searches " << searches << " candidates " << candidates
+            << " average " << static_cast<double> (candidates) / searches
+            << " max " << max_candidates << "\n";
+    if (lazy_tries > 0)
+        out << "lazy: tries " << lazy_tries << " hits " << lazy_hits
+            << " rate " << 100.0 * lazy_hits / lazy_tries << "%\n";
+    std::uint64_t const times[] = {match_ns, table_ns, output_ns,
+        digest_ns, decode_ns};
+    char const* const stages[] = {"match", "table", "output", "digest",
+        "decode"};
+    out << "time (ms):";
+    for (int i = 0; i < 5; ++i)
+        if (times[i] > 0)
+            out << " " << stages[i] << " " << ms (times[i]);
+    out << "\n";
+    report_histogram (out, "length codes", lengths, 29, 257);
+    report_histogram (out, "distance codes", distances, 30, 0);
+    for (std::size_t i = 0; i < blocks.size (); ++i) {
+        block_stats const& b = blocks[i];
+        out << "block " << i << ": " << block_type_name (b.type)
+            << (b.final ? " final" : "") << " bytes " << b.bytes
+            << " literals " << b.literals << " matches " << b.matches;
+        if (b.bits > 0)
+            out << " bits " << b.bits;
+        if (b.type == 2)
+            out << " hlit " << b.hlit << " hdist " << b.hdist
+                << " hclen " << b.hclen;
+        if (b.table_bits > 0)
+            out << " table bits " << b.table_bits;
+        out << "\n";
+    }
+    out.flags (flags);
+}
+
+}// namespace deflate
@@ -0,0 +1,461 @@
+/* push-mode streams over caller-owned buffers
+ *
+ *  1. the caller gives spans of input and output, and the stream
+ *     advances the pointers over the bytes taken and given.
+ *  2. the compressor and the decompressor run as state machines,
+ *     so that they stop at any byte when the input runs short or
+ *     the output is full, and resume on the next call.
+ *  3. a gzip stream returns STREAM_END at the end of each member, and
+ *     it starts the next member when more input comes.
+ *
+ * References:
+ *
+ *  P. Deutsch, ``RFC 1951 DEFLATE Compressed Data Format Specification
+ *     version 1.3'', 1996
+ *
+ *  P. Deutsch and J-L. Gailly, ``RFC 1950 ZLIB Compressed Data Format
+ *     Specification version 3.3'', 1996
+ *
+ *  P. Deutsch, ``RFC 1952 GZIP file format specification version 4.3'', 1996
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+std::shared_ptr<digest_base> make_digest (int const format)
+{
+    if (format == FORMAT_ZLIB)
+        return std::make_shared<digest_adler32> ();
+    if (format == FORMAT_RAW)
+        return std::make_shared<digest_base> ();
+    return std::make_shared<digest_crc32> ();
+}
+
+template <class LZSS>
+basic_deflate_stream<LZSS>::basic_deflate_stream (int aformat)
+    : format (aformat), finished (false), flushed (true), rsyncable (false),
+      rolling (0), unsynced (0), stats (nullptr),
+      digest (make_digest (aformat)), lzss (digest), encoder ()
+{
+    if (format != FORMAT_GZIP && format != FORMAT_ZLIB && format != FORMAT_RAW)
+        throw std::runtime_error ("deflate_stream: unsupported format.");
+    /* the tables of small blocks come from the heuristic lengths, whose
+     * build time keeps small next to that of the few codes, and their
+     * code lists take the limit and the end of block at once.
+     */
+    int const blockcodes = LZSS::BLOCKCODES;
+    if (blockcodes > 0 && blockcodes <= SMALLBLOCK) {
+        encoder.set_fast_tables (true);
+        encoder.reserve (blockcodes + 1);
+    }
+    reset ();
+}
+
+/* start a new stream over the same buffers and tables */
+template <class LZSS>
+void basic_deflate_stream<LZSS>::reset ()
+{
+    finished = false;
+    flushed = true;
+    rolling = 0;
+    unsynced = 0;
+    encoder.wait ();
+    encoder.discard ();
+    if (format == FORMAT_GZIP)
+        put_gzip_header (encoder);
+    else if (format == FORMAT_ZLIB) {
+        /* CM = 8, CINFO = log2 (window) - 8, FLEVEL = 2, FCHECK:
+         * 0x78 0x9c for the 32K window.
+         */
+        std::uint32_t const cmf = ((LZSS::WINBITS - 8) << 4) | 8;
+        std::uint32_t const flg = 2 << 6;
+        encoder.putbyte (cmf);
+        encoder.putbyte (flg | (31 - (cmf * 256 + flg) % 31) % 31);
+    }
+    lzss.compress_begin (encoder);
+}
+
+/* keep the counters of the stream in s, or stop with nullptr */
+template <class LZSS>
+void basic_deflate_stream<LZSS>::set_stats (stream_stats* s)
+{
+    stats = s;
+    lzss.set_stats (s);
+    encoder.set_stats (s);
+}
+
+/* the stream of the calling thread for each format, reset for use */
+deflate_stream& thread_deflate_stream (int const format)
+{
+    static thread_local std::unique_ptr<deflate_stream> streams[4];
+    if (format < 0 || format >= 4)
+        throw std::runtime_error ("deflate_stream: unsupported format.");
+    if (! streams[format])
+        streams[format].reset (new deflate_stream (format));
+    else
+        streams[format]->reset ();
+    return *streams[format];
+}
+
+/* compress the input span into the output span. it returns STREAM_END
+ * after the trailer went out with STREAM_FINISH, STREAM_NEED_INPUT when
+ * it took all the input, or STREAM_OUTPUT_FULL when the output span is
+ * full. STREAM_SYNC_FLUSH and STREAM_FULL_FLUSH end the block after all
+ * the input, once for the input since the last flush. With the encoder
+ * thread, the output waits while it encodes a block, and a flush or the
+ * finish waits for it.
+ */
+template <class LZSS>
+int basic_deflate_stream<LZSS>::compress (std::uint8_t const*& next_in,
+    std::size_t& avail_in, std::uint8_t*& next_out, std::size_t& avail_out,
+    int flush)
+{
+    std::size_t const chunk = LZSS::BUFSIZE - LZSS::WINSIZE;
+    for (;;) {
+        if (encoder.ready ()) {
+            std::size_t const n = encoder.drain (next_out, avail_out);
+            next_out += n;
+            avail_out -= n;
+            if (stats != nullptr)
+                stats->output += n;
+            if (encoder.pending () > 0)
+                return STREAM_OUTPUT_FULL;
+            if (finished)
+                return STREAM_END;
+        }
+        if (avail_in > 0) {
+            std::size_t n = std::min (avail_in, chunk);
+            bool point = false;
+            if (rsyncable) {
+                n = rsync_scan (next_in, n);
+                point = unsynced == 0;
+            }
+            std::size_t const m = lzss.compress_feed (next_in, n, encoder);
+            next_in += m;
+            avail_in -= m;
+            if (stats != nullptr)
+                stats->input += m;
+            flushed = false;
+            if (point) {
+                lzss.compress_flush (encoder, false);
+                flushed = true;
+            }
+            continue;
+        }
+        if (flush == STREAM_NO_FLUSH || (flush != STREAM_FINISH && flushed))
+            return STREAM_NEED_INPUT;
+        if (flush != STREAM_FINISH) {
+            lzss.compress_flush (encoder, flush == STREAM_FULL_FLUSH);
+            flushed = true;
+            continue;
+        }
+        std::size_t const size = lzss.compress_finish (encoder);
+        encoder.wait ();
+        if (format == FORMAT_GZIP) {
+            encoder.put4byte (digest->digest ());
+            encoder.put4byte (size);
+        }
+        else if (format == FORMAT_ZLIB)
+            encoder.put4byte_bigendian (digest->digest ());
+        encoder.flush ();
+        finished = true;
+    }
+}
+
+/* the gear table of the rolling hash: random words from a fixed seed,
+ * so that the points stay at the same bytes over the builds.
+ */
+static std::uint64_t const* gear_table ()
+{
+    static std::uint64_t table[256];
+    static bool const made = []{
+        std::uint64_t x = 0x9e3779b97f4a7c15ULL;
+        for (int i = 0; i < 256; ++i) {
+            /* splitmix64 */
+            std::uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            table[i] = z ^ (z >> 31);
+        }
+        return true;
+    }();
+    (void) made;
+    return table;
+}
+
+/* the bytes up to the next point of the rsyncable mode, or all n bytes.
+ * a point falls where the top RSYNCBITS of the gear hash are 0, which
+ * depend only on the last 64 bytes, after RSYNCMIN bytes since the last
+ * point. unsynced is 0 just after a point, and the hash starts anew, so
+ * that the same content finds the same points after an edit.
+ */
+template <class LZSS>
+std::size_t basic_deflate_stream<LZSS>::rsync_scan (std::uint8_t const* p,
+    std::size_t n)
+{
+    std::uint64_t const* gear = gear_table ();
+    std::uint64_t h = rolling;
+    for (std::size_t i = 0; i < n; ++i) {
+        h = (h << 1) + gear[p[i]];
+        if (++unsynced >= RSYNCMIN && (h >> (64 - RSYNCBITS)) == 0) {
+            rolling = 0;
+            unsynced = 0;
+            return i + 1;
+        }
+    }
+    rolling = h;
+    return n;
+}
+
+template class basic_deflate_stream<lzss_compression>;
+template class basic_deflate_stream<lzss_compression_small>;
+
+/* a stream of the profile, for the callers choosing it at the run time */
+std::unique_ptr<deflate_stream_base> make_deflate_stream (int const format,
+    int const profile)
+{
+    if (profile == PROFILE_DEFAULT)
+        return std::unique_ptr<deflate_stream_base> (
+            new deflate_stream (format));
+    if (profile == PROFILE_SMALL)
+        return std::unique_ptr<deflate_stream_base> (
+            new small_deflate_stream (format));
+    throw std::runtime_error ("deflate_stream: unknown profile.");
+}
+
+inflate_stream::inflate_stream (int aformat)
+    : format (aformat), state (aformat == FORMAT_RAW ? BODY : HEADER),
+      taken (0), stats (nullptr), hbuf (), mheader (),
+      digest (make_digest (aformat)), lzss (digest), decoder (lzss)
+{
+    mheader.bsize = -1;
+    mheader.msize = -1;
+    mheader.length = 0;
+    /* keep decoded bytes in the ring buffer until the caller takes them */
+    lzss.set_hold (true);
+}
+
+/* start a new stream over the same buffers, dropping any input in hand */
+void inflate_stream::reset ()
+{
+    state = format == FORMAT_RAW ? BODY : HEADER;
+    hbuf.clear ();
+    mheader.bsize = -1;
+    mheader.msize = -1;
+    mheader.length = 0;
+    taken = 0;
+    lzss.reset ();
+    decoder.reset ();
+}
+
+/* decode at most n bytes ahead of the caller of decompress_span */
+void inflate_stream::set_chunk (std::size_t const n)
+{
+    decoder.set_limit (std::max (static_cast<std::size_t> (1),
+        std::min (n, static_cast<std::size_t> (lzss_compression::BUFSIZE))));
+}
+
+/* keep the counters of the stream in s, or stop with nullptr */
+void inflate_stream::set_stats (stream_stats* s)
+{
+    stats = s;
+    decoder.set_stats (s);
+}
+
+/* the stream of the calling thread for each format, reset for use */
+inflate_stream& thread_inflate_stream (int const format)
+{
+    static thread_local std::unique_ptr<inflate_stream> streams[4];
+    if (format < 0 || format >= 4)
+        throw std::runtime_error ("inflate_stream: unsupported format.");
+    if (! streams[format])
+        streams[format].reset (new inflate_stream (format));
+    else
+        streams[format]->reset ();
+    return *streams[format];
+}
+
+/* decompress the input span into the output span. it returns STREAM_END
+ * at the end of the stream or of a gzip member, STREAM_NEED_INPUT when
+ * it took all the input, or STREAM_OUTPUT_FULL when the output span is
+ * full.
+ */
+int inflate_stream::decompress (std::uint8_t const*& next_in,
+    std::size_t& avail_in, std::uint8_t*& next_out, std::size_t& avail_out)
+{
+    /* the span of decompress_span, if any, has been taken */
+    lzss.release (taken);
+    taken = 0;
+    if (stats == nullptr)
+        return inflate (next_in, avail_in, next_out, avail_out);
+    std::size_t const given_in = avail_in;
+    std::size_t const given_out = avail_out;
+    int const r = inflate (next_in, avail_in, next_out, avail_out);
+    stats->input += given_in - avail_in;
+    stats->output += given_out - avail_out;
+    return r;
+}
+
+/* the pull mode: give the decoded bytes in place as span and size, which
+ * stay valid until the next call takes them. the result is that of
+ * decompress, with STREAM_OUTPUT_FULL while the span has more to come.
+ */
+int inflate_stream::decompress_span (std::uint8_t const*& next_in,
+    std::size_t& avail_in, std::uint8_t const*& span, std::size_t& size)
+{
+    lzss.release (taken);
+    taken = 0;
+    int r = STREAM_OUTPUT_FULL;
+    if (lzss.pending () == 0) {
+        std::uint8_t* next_out = nullptr;
+        std::size_t avail_out = 0;
+        std::size_t const given_in = avail_in;
+        r = inflate (next_in, avail_in, next_out, avail_out);
+        if (stats != nullptr)
+            stats->input += given_in - avail_in;
+    }
+    size = taken = lzss.held (span);
+    if (stats != nullptr)
+        stats->output += size;
+    return r;
+}
+
+int inflate_stream::inflate (std::uint8_t const*& next_in,
+    std::size_t& avail_in, std::uint8_t*& next_out, std::size_t& avail_out)
+{
+    std::size_t const tsize = format == FORMAT_ZLIB ? 4
+        : format == FORMAT_RAW ? 0 : 8;
+    bool ended = false;         /* a member ended in this call */
+    for (;;) {
+        std::size_t const n = lzss.drain (next_out, avail_out);
+        next_out += n;
+        avail_out -= n;
+        if (state == END) {
+            if (lzss.pending () > 0)
+                return STREAM_OUTPUT_FULL;
+            if (ended || avail_in == 0 || format == FORMAT_ZLIB
+                    || format == FORMAT_RAW)
+                return STREAM_END;
+            /* the next member of a gzip file */
+            state = HEADER;
+        }
+        if (state == HEADER) {
+            if (format == FORMAT_ZLIB) {
+                for (; hbuf.size () < 2 && avail_in > 0; --avail_in)
+                    hbuf.push_back (*next_in++);
+                if (hbuf.size () < 2)
+                    return STREAM_NEED_INPUT;
+                check_zlib_header (static_cast<std::uint8_t> (hbuf[0]),
+                    static_cast<std::uint8_t> (hbuf[1]));
+            }
+            else {
+                while (parse_gzip_header (hbuf, mheader) == 0) {
+                    if (avail_in == 0)
+                        return STREAM_NEED_INPUT;
+                    for (; hbuf.size () < mheader.length && avail_in > 0; --avail_in)
+                        hbuf.push_back (*next_in++);
+                }
+            }
+            hbuf.clear ();
+            lzss.reset ();
+            decoder.reset ();
+            state = BODY;
+        }
+        if (state == BODY) {
+            decoder.feed (next_in, avail_in);
+            int const r = decoder.inflate ();
+            std::size_t const m = avail_in - decoder.avail ();
+            next_in += m;
+            avail_in -= m;
+            if (r == STREAM_NEED_INPUT)
+                return STREAM_NEED_INPUT;
+            if (r == STREAM_OUTPUT_FULL) {
+                if (avail_out == 0)
+                    return STREAM_OUTPUT_FULL;
+                continue;
+            }
+            decoder.align ();
+            state = TRAILER;
+        }
+        if (state == TRAILER) {
+            /* the digest takes the bytes as they go out */
+            if (lzss.pending () > 0) {
+                if (avail_out == 0)
+                    return STREAM_OUTPUT_FULL;
+                continue;
+            }
+            decoder.feed (next_in, avail_in);
+            while (hbuf.size () < tsize && decoder.need (8)) {
+                hbuf.push_back (decoder.peek (8));
+                decoder.drop (8);
+            }
+            std::size_t const m = avail_in - decoder.avail ();
+            next_in += m;
+            avail_in -= m;
+            if (hbuf.size () < tsize)
+                return STREAM_NEED_INPUT;
+            check_trailer ();
+            hbuf.clear ();
+            state = END;
+            ended = true;
+        }
+    }
+}
+
+void inflate_stream::check_trailer ()
+{
+    std::uint32_t t[8];
+    for (std::size_t i = 0; i < hbuf.size (); ++i)
+        t[i] = static_cast<std::uint8_t> (hbuf[i]);
+    if (format == FORMAT_ZLIB) {
+        std::uint32_t const adler32
+            = (t[0] << 24) | (t[1] << 16) | (t[2] << 8) | t[3];
+        if (digest->digest () != adler32)
+            throw std::runtime_error ("cppgzip: mismatch Adler-32.");
+    }
+    else if (format != FORMAT_RAW) {
+        std::uint32_t const crc32
+            = t[0] | (t[1] << 8) | (t[2] << 16) | (t[3] << 24);
+        std::uint32_t const isize
+            = t[4] | (t[5] << 8) | (t[6] << 16) | (t[7] << 24);
+        if (digest->digest () != crc32)
+            throw std::runtime_error ("cppgzip: mismatch CRC32.");
+        if ((lzss.size () & 0xffffffffL) != isize)
+            throw std::runtime_error ("cppgzip: mismatch ISIZE.");
+    }
+}
+
+}// namespace deflate
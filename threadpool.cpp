@@ -0,0 +1,148 @@
+/* fixed size thread pool for block parallel (de)compression
+ *
+ *  1. each worker has its own task queue, and an idle worker steals
+ *     tasks from the queues of the others.
+ *  2. the tasks from outside go round-robin over the queues, and those
+ *     from a task go into the queue of its worker.
+ *  3. both the owner and the thieves take the oldest task first, so
+ *     the order of submission holds roughly across the queues.
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "deflate.hpp"
+
+namespace deflate {
+
+/* the pool and the queue index of the calling worker thread */
+static thread_local thread_pool const* current_pool = nullptr;
+static thread_local int current_index = 0;
+
+thread_pool::thread_pool (int nthreads)
+    : workers (), queues (), queued (0), next (0),
+      mutex (), task_ready (), task_done (),
+      pending (0), stopping (false), error (nullptr)
+{
+    if (nthreads < 1)
+        nthreads = 1;
+    for (int i = 0; i < nthreads; ++i)
+        queues.emplace_back (new task_queue ());
+    for (int i = 0; i < nthreads; ++i)
+        workers.emplace_back (&thread_pool::run, this, i);
+}
+
+thread_pool::~thread_pool ()
+{
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        stopping = true;
+    }
+    task_ready.notify_all ();
+    for (auto& t : workers)
+        t.join ();
+}
+
+void thread_pool::submit (std::function<void()> const& task)
+{
+    int const index = current_pool == this ? current_index
+        : next++ % queues.size ();
+    {
+        std::lock_guard<std::mutex> lock (mutex);
+        ++pending;
+        ++queued;
+    }
+    {
+        std::lock_guard<std::mutex> lock (queues[index]->mutex);
+        queues[index]->tasks.push_back (task);
+    }
+    task_ready.notify_one ();
+}
+
+/* wait for all submitted tasks, and rethrow the first exception in them. */
+void thread_pool::wait ()
+{
+    std::unique_lock<std::mutex> lock (mutex);
+    task_done.wait (lock, [this]{ return pending == 0; });
+    if (error != nullptr) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception (e);
+    }
+}
+
+/* take a task from the own queue, or steal one from the others. */
+bool thread_pool::take (int index, std::function<void()>& task)
+{
+    int const n = queues.size ();
+    for (int i = 0; i < n; ++i) {
+        task_queue& q = *queues[(index + i) % n];
+        std::lock_guard<std::mutex> lock (q.mutex);
+        if (! q.tasks.empty ()) {
+            task = std::move (q.tasks.front ());
+            q.tasks.pop_front ();
+            --queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void thread_pool::run (int index)
+{
+    current_pool = this;
+    current_index = index;
+    for (;;) {
+        std::function<void()> task;
+        if (! take (index, task)) {
+            std::unique_lock<std::mutex> lock (mutex);
+            task_ready.wait (lock, [this]{ return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+            continue;
+        }
+        std::exception_ptr e = nullptr;
+        try {
+            task ();
+        }
+        catch (...) {
+            e = std::current_exception ();
+        }
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            if (e != nullptr && error == nullptr)
+                error = e;
+            --pending;
+        }
+        task_done.notify_all ();
+    }
+}
+
+}// namespace deflate
@@ -0,0 +1,551 @@
+/* io_uring I/O engine for batches of small files
+ *
+ *  1. the I/O thread opens, reads, writes and closes the files through
+ *     a single ring, and keeps at most DEPTH files in flight, so that
+ *     the buffers in memory are bounded.
+ *  2. the thread pool (de)compresses the files read into memory, and
+ *     wakes the I/O thread through a read of an eventfd on the ring.
+ *  3. the large files and BGZF compression take gzip_batch over the
+ *     memory mappings.
+ *  4. without io_uring at the build or at the run time, or without its
+ *     operations on the files, probed at the setup, all the files take
+ *     gzip_batch with the blocking system calls.
+ *
+ * References:
+ *
+ *  J. Axboe, ``Efficient IO with io_uring'', 2019
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "deflate.hpp"
+
+#if defined (__linux__) && defined (__has_include)
+#if __has_include (<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace deflate {
+
+enum {SMALLSIZE = 1024 * 1024};
+
+#ifdef HAVE_IO_URING
+
+enum {DEPTH = 64, RINGSIZE = 4 * DEPTH};
+
+/* the submission and completion rings over the raw system calls */
+class io_ring {
+public:
+    explicit io_ring (unsigned entries);
+    ~io_ring ();
+    io_ring (io_ring const&) = delete;
+    io_ring& operator= (io_ring const&) = delete;
+    io_uring_sqe* get_sqe ();
+    void submit (unsigned wait);
+    bool take_cqe (io_uring_cqe& cqe);
+private:
+    int fd;
+    void* sqmap;
+    std::size_t sqlen;
+    void* cqmap;
+    std::size_t cqlen;
+    io_uring_sqe* sqes;
+    std::size_t sqeslen;
+    unsigned* sqhead;
+    unsigned* sqtail;
+    unsigned* sqmask;
+    unsigned* sqentries;
+    unsigned* sqarray;
+    unsigned* cqhead;
+    unsigned* cqtail;
+    unsigned* cqmask;
+    io_uring_cqe* cqes;
+    unsigned tosubmit;
+    bool probe ();
+    void unmap ();
+};
+
+io_ring::io_ring (unsigned entries)
+    : fd (-1), sqmap (MAP_FAILED), sqlen (0), cqmap (MAP_FAILED), cqlen (0),
+      sqes (nullptr), sqeslen (0), tosubmit (0)
+{
+    io_uring_params p;
+    std::memset (&p, 0, sizeof (p));
+    fd = ::syscall (__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        throw std::runtime_error ("io_ring: io_uring_setup failed.");
+    sqlen = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    cqlen = p.cq_off.cqes + p.cq_entries * sizeof (io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        sqlen = cqlen = std::max (sqlen, cqlen);
+    sqmap = ::mmap (nullptr, sqlen, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqmap != MAP_FAILED && (p.features & IORING_FEAT_SINGLE_MMAP))
+        cqmap = sqmap;
+    else if (sqmap != MAP_FAILED)
+        cqmap = ::mmap (nullptr, cqlen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    sqeslen = p.sq_entries * sizeof (io_uring_sqe);
+    void* e = MAP_FAILED;
+    if (cqmap != MAP_FAILED)
+        e = ::mmap (nullptr, sqeslen, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (e == MAP_FAILED) {
+        unmap ();
+        throw std::runtime_error ("io_ring: mmap failed.");
+    }
+    sqes = static_cast<io_uring_sqe*> (e);
+    char* sq = static_cast<char*> (sqmap);
+    char* cq = static_cast<char*> (cqmap);
+    sqhead = reinterpret_cast<unsigned*> (sq + p.sq_off.head);
+    sqtail = reinterpret_cast<unsigned*> (sq + p.sq_off.tail);
+    sqmask = reinterpret_cast<unsigned*> (sq + p.sq_off.ring_mask);
+    sqentries = reinterpret_cast<unsigned*> (sq + p.sq_off.ring_entries);
+    sqarray = reinterpret_cast<unsigned*> (sq + p.sq_off.array);
+    cqhead = reinterpret_cast<unsigned*> (cq + p.cq_off.head);
+    cqtail = reinterpret_cast<unsigned*> (cq + p.cq_off.tail);
+    cqmask = reinterpret_cast<unsigned*> (cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*> (cq + p.cq_off.cqes);
+    if (! probe ()) {
+        unmap ();
+        throw std::runtime_error ("io_ring: the operations are missing.");
+    }
+}
+
+/* the kernels before 5.6 set up a ring without the operations on the
+ * files, and without the probe of them.
+ */
+bool io_ring::probe ()
+{
+    enum {NOPS = 256};
+    std::vector<char> buf (sizeof (io_uring_probe)
+        + NOPS * sizeof (io_uring_probe_op), 0);
+    io_uring_probe* const q = reinterpret_cast<io_uring_probe*> (&buf[0]);
+    if (::syscall (__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+            q, NOPS) < 0)
+        return false;
+    int const ops[] = {
+        IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE
+    };
+    for (int op : ops)
+        if (op > q->last_op || ! (q->ops[op].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    return true;
+}
+
+io_ring::~io_ring ()
+{
+    unmap ();
+}
+
+void io_ring::unmap ()
+{
+    if (sqes != nullptr)
+        ::munmap (sqes, sqeslen);
+    if (cqmap != MAP_FAILED && cqmap != sqmap)
+        ::munmap (cqmap, cqlen);
+    if (sqmap != MAP_FAILED)
+        ::munmap (sqmap, sqlen);
+    if (fd >= 0)
+        ::close (fd);
+}
+
+/* a cleared entry at the tail, submitting the queue first when full */
+io_uring_sqe* io_ring::get_sqe ()
+{
+    unsigned const tail = *sqtail;
+    if (tail - __atomic_load_n (sqhead, __ATOMIC_ACQUIRE) >= *sqentries)
+        submit (0);
+    unsigned const index = tail & *sqmask;
+    io_uring_sqe* sqe = &sqes[index];
+    std::memset (sqe, 0, sizeof (*sqe));
+    sqarray[index] = index;
+    __atomic_store_n (sqtail, tail + 1, __ATOMIC_RELEASE);
+    ++tosubmit;
+    return sqe;
+}
+
+void io_ring::submit (unsigned wait)
+{
+    for (;;) {
+        int const r = ::syscall (__NR_io_uring_enter, fd, tosubmit, wait,
+            wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (r >= 0) {
+            tosubmit -= std::min (tosubmit, static_cast<unsigned> (r));
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            throw std::runtime_error ("io_ring: io_uring_enter failed.");
+    }
+}
+
+bool io_ring::take_cqe (io_uring_cqe& cqe)
+{
+    unsigned const head = *cqhead;
+    if (head == __atomic_load_n (cqtail, __ATOMIC_ACQUIRE))
+        return false;
+    cqe = cqes[head & *cqmask];
+    __atomic_store_n (cqhead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/* a file in flight through its states */
+struct uring_file {
+    enum {OPEN_INPUT, READ, COMPUTE, OPEN_OUTPUT, WRITE};
+    std::string path;
+    std::string outpath;
+    std::size_t size;
+    int state;
+    int fd;
+    std::size_t done;
+    std::string input;
+    std::string output;
+    std::string error;
+};
+
+static std::uint64_t const EVENT_TAG = 1;
+
+static void decompress_string (int format, std::string const& input,
+    std::string& output)
+{
+    std::uint8_t const* next_in = reinterpret_cast<std::uint8_t const*> (input.data ());
+    std::size_t avail_in = input.size ();
+    std::size_t used = 0;
+    /* ISIZE of the last member, within what the input expands to */
+    std::size_t const hint = format != FORMAT_ZLIB && format != FORMAT_RAW
+        ? isize_hint (next_in, avail_in) : avail_in * 4;
+    output.resize (std::max (static_cast<std::size_t> (4096), hint));
+    inflate_stream& z = thread_inflate_stream (
+        format == FORMAT_BGZF ? FORMAT_GZIP : format);
+    for (;;) {
+        std::uint8_t* base = reinterpret_cast<std::uint8_t*> (&output[0]);
+        std::uint8_t* next_out = base + used;
+        std::size_t avail_out = output.size () - used;
+        int const r = z.decompress (next_in, avail_in, next_out, avail_out);
+        used = next_out - base;
+        if (r == STREAM_END && (avail_in == 0
+                || format == FORMAT_ZLIB || format == FORMAT_RAW))
+            break;
+        if (r == STREAM_NEED_INPUT)
+            throw std::runtime_error ("cppgzip: unexpected end-of-file.");
+        if (r == STREAM_OUTPUT_FULL)
+            output.resize (output.size () * 2);
+    }
+    output.resize (used);
+}
+
+static std::string errno_message (std::string const& path, int const e)
+{
+    return "cppgzip: " + path + ": " + std::strerror (e);
+}
+
+static int uring_batch (io_ring& ring, std::vector<uring_file>& files,
+    bool decompress, int format, int nthreads, std::ostream& report)
+{
+    int const efd = ::eventfd (0, EFD_CLOEXEC);
+    if (efd < 0)
+        throw std::runtime_error ("io_ring: eventfd failed.");
+    std::uint64_t event = 0;
+    auto arm_event = [&]{
+        io_uring_sqe* sqe = ring.get_sqe ();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = efd;
+        sqe->addr = reinterpret_cast<std::uint64_t> (&event);
+        sqe->len = sizeof (event);
+        sqe->user_data = EVENT_TAG;
+    };
+    auto submit_open = [&](uring_file& f, char const* path, int flags) {
+        io_uring_sqe* sqe = ring.get_sqe ();
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<std::uint64_t> (path);
+        sqe->open_flags = flags | O_CLOEXEC;
+        sqe->len = 0644;
+        sqe->user_data = reinterpret_cast<std::uint64_t> (&f);
+    };
+    auto submit_rw = [&](uring_file& f, int opcode, std::string& buf) {
+        io_uring_sqe* sqe = ring.get_sqe ();
+        sqe->opcode = opcode;
+        sqe->fd = f.fd;
+        sqe->addr = reinterpret_cast<std::uint64_t> (&buf[f.done]);
+        sqe->len = std::min (buf.size () - f.done, static_cast<std::size_t> (1 << 30));
+        sqe->off = f.done;
+        sqe->user_data = reinterpret_cast<std::uint64_t> (&f);
+    };
+    auto submit_close = [&](int fd) {
+        io_uring_sqe* sqe = ring.get_sqe ();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = fd;
+        sqe->user_data = 0;
+    };
+
+    std::mutex mutex;
+    std::vector<uring_file*> computed;
+    int nfailed = 0;
+    int inflight = 0;
+    auto finish = [&](uring_file& f) {
+        if (! f.error.empty ()) {
+            ++nfailed;
+            report << f.path << ": FAILED " << f.error << std::endl;
+        }
+        std::string ().swap (f.input);
+        std::string ().swap (f.output);
+        --inflight;
+    };
+    auto fail = [&](uring_file& f, std::string const& message) {
+        f.error = message;
+        if (f.fd >= 0)
+            submit_close (f.fd);
+        if (f.state == uring_file::WRITE)
+            ::unlink (f.outpath.c_str ());
+        f.fd = -1;
+        finish (f);
+    };
+
+    thread_pool pool (nthreads);
+    auto compute = [&](uring_file& f) {
+        f.state = uring_file::COMPUTE;
+        uring_file* p = &f;
+        pool.submit ([&, p, format, decompress]{
+            try {
+                if (decompress)
+                    decompress_string (format, p->input, p->output);
+                else
+                    compress_span (format,
+                        reinterpret_cast<std::uint8_t const*> (p->input.data ()),
+                        p->input.size (),
+                        [p](std::uint8_t const* s, std::size_t n) {
+                            p->output.append (reinterpret_cast<char const*> (s), n);
+                        });
+            }
+            catch (std::exception& e) {
+                p->error = e.what ();
+            }
+            std::string ().swap (p->input);
+            {
+                std::lock_guard<std::mutex> lock (mutex);
+                computed.push_back (p);
+            }
+            std::uint64_t const one = 1;
+            ssize_t const r = ::write (efd, &one, sizeof (one));
+            (void) r;
+        });
+    };
+
+    arm_event ();
+    std::size_t next = 0;
+    while (next < files.size () || inflight > 0) {
+        for (; inflight < DEPTH && next < files.size (); ++next, ++inflight) {
+            uring_file& f = files[next];
+            f.state = uring_file::OPEN_INPUT;
+            submit_open (f, f.path.c_str (), O_RDONLY);
+        }
+        std::vector<uring_file*> ready;
+        {
+            std::lock_guard<std::mutex> lock (mutex);
+            ready.swap (computed);
+        }
+        for (uring_file* f : ready) {
+            if (! f->error.empty ()) {
+                finish (*f);
+                continue;
+            }
+            f->state = uring_file::OPEN_OUTPUT;
+            submit_open (*f, f->outpath.c_str (), O_WRONLY | O_CREAT | O_EXCL);
+        }
+        if (! ready.empty ())
+            continue;
+        ring.submit (1);
+        io_uring_cqe cqe;
+        while (ring.take_cqe (cqe)) {
+            if (cqe.user_data == 0)
+                continue;
+            if (cqe.user_data == EVENT_TAG) {
+                arm_event ();
+                continue;
+            }
+            uring_file& f = *reinterpret_cast<uring_file*> (cqe.user_data);
+            int const res = cqe.res;
+            switch (f.state) {
+            case uring_file::OPEN_INPUT:
+                if (res < 0) {
+                    fail (f, errno_message (f.path, -res));
+                    break;
+                }
+                f.fd = res;
+                f.done = 0;
+                f.input.resize (f.size);
+                f.state = uring_file::READ;
+                if (f.size > 0) {
+                    submit_rw (f, IORING_OP_READ, f.input);
+                    break;
+                }
+                submit_close (f.fd);
+                f.fd = -1;
+                compute (f);
+                break;
+            case uring_file::READ:
+                if (res < 0) {
+                    fail (f, errno_message (f.path, -res));
+                    break;
+                }
+                f.done += res;
+                if (res > 0 && f.done < f.input.size ()) {
+                    submit_rw (f, IORING_OP_READ, f.input);
+                    break;
+                }
+                /* the file may have shrunk since the stat */
+                f.input.resize (f.done);
+                submit_close (f.fd);
+                f.fd = -1;
+                compute (f);
+                break;
+            case uring_file::OPEN_OUTPUT:
+                if (res == -EEXIST) {
+                    fail (f, "cppgzip: " + f.outpath + ": already exists.");
+                    break;
+                }
+                if (res < 0) {
+                    fail (f, errno_message (f.outpath, -res));
+                    break;
+                }
+                f.fd = res;
+                f.done = 0;
+                f.state = uring_file::WRITE;
+                if (! f.output.empty ()) {
+                    submit_rw (f, IORING_OP_WRITE, f.output);
+                    break;
+                }
+                submit_close (f.fd);
+                finish (f);
+                break;
+            case uring_file::WRITE:
+                if (res <= 0) {
+                    fail (f, errno_message (f.outpath, res < 0 ? -res : EIO));
+                    break;
+                }
+                f.done += res;
+                if (f.done < f.output.size ()) {
+                    submit_rw (f, IORING_OP_WRITE, f.output);
+                    break;
+                }
+                submit_close (f.fd);
+                f.fd = -1;
+                finish (f);
+                break;
+            }
+        }
+    }
+    /* the closes left in the ring */
+    ring.submit (0);
+    pool.wait ();
+    ::close (efd);
+    return nfailed;
+}
+
+#endif
+
+/* the batch over io_uring for the small files, or gzip_batch without it */
+int gzip_batch_uring (std::vector<std::string> const& paths, bool decompress,
+    int format, int nthreads, std::ostream& report)
+{
+#ifdef HAVE_IO_URING
+    std::vector<std::string> large;
+    std::vector<uring_file> files;
+    std::string const suffix = file_suffix (format);
+    int nfailed = 0;
+    for (std::string const& path : paths) {
+        struct stat st;
+        if (::stat (path.c_str (), &st) < 0 || ! S_ISREG (st.st_mode)
+                || static_cast<std::size_t> (st.st_size) >= SMALLSIZE
+                || (! decompress && format == FORMAT_BGZF)) {
+            large.push_back (path);
+            continue;
+        }
+        uring_file f;
+        f.path = path;
+        if (! decompress)
+            f.outpath = path + suffix;
+        else if (path.size () > suffix.size ()
+                && path.compare (path.size () - suffix.size (), suffix.size (), suffix) == 0)
+            f.outpath = path.substr (0, path.size () - suffix.size ());
+        else {
+            ++nfailed;
+            report << path << ": FAILED cppgzip: " << path << ": unknown suffix." << std::endl;
+            continue;
+        }
+        f.size = st.st_size;
+        f.state = uring_file::OPEN_INPUT;
+        f.fd = -1;
+        f.done = 0;
+        files.push_back (f);
+    }
+    if (! large.empty ())
+        nfailed += gzip_batch (large, decompress, format, nthreads, report);
+    if (files.empty ())
+        return nfailed;
+    std::stable_sort (files.begin (), files.end (),
+        [](uring_file const& a, uring_file const& b) { return a.size > b.size; });
+    std::unique_ptr<io_ring> ring;
+    try {
+        ring.reset (new io_ring (RINGSIZE));
+    }
+    catch (std::runtime_error&) {
+        /* no io_uring or its operations at the run time */
+    }
+    if (ring)
+        return nfailed + uring_batch (*ring, files, decompress, format,
+            nthreads, report);
+    std::vector<std::string> small;
+    for (uring_file const& f : files)
+        small.push_back (f.path);
+    return nfailed + gzip_batch (small, decompress, format, nthreads, report);
+#else
+    return gzip_batch (paths, decompress, format, nthreads, report);
+#endif
+}
+
+}// namespace deflate
@@ -0,0 +1,87 @@
+/* decompression in the zlib format and raw Deflate
+ *
+ * References:
+ *
+ *  P. Deutsch and J-L. Gailly, ``RFC 1950 ZLIB Compressed Data Format
+ *     Specification version 3.3'', 1996
+ *
+ * License: The BSD 3-Clause
+ *
+ * Copyright (c) 2015, MIZUTANI Tociyuki
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <stdexcept>
+#include "deflate.hpp"
+
+namespace deflate {
+
+/* 2.2. Data format: CMF and FLG */
+void check_zlib_header (std::uint32_t const cmf, std::uint32_t const flg)
+{
+    if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7)
+        throw std::runtime_error ("cppgzip: illegal zlib CMF.");
+    if (((cmf << 8) | flg) % 31 != 0)
+        throw std::runtime_error ("cppgzip: illegal zlib FCHECK.");
+    if (flg & 0x20)
+        throw std::runtime_error ("cppgzip: zlib preset dictionary is not supported.");
+}
+
+void zlib_decompress (std::istream& cin, std::ostream* cout,
+    stream_stats* stats)
+{
+    auto adler32 = std::make_shared<digest_adler32> ();
+    lzss_compression lzss (adler32);
+    huffman_decoder decoder (cin, lzss);
+    decoder.set_stats (stats);
+    std::uint32_t cmf = decoder.getbyte ();
+    std::uint32_t flg = decoder.getbyte ();
+    check_zlib_header (cmf, flg);
+    std::size_t const size
+        = cout != nullptr ? decoder.decode (*cout) : decoder.decode ();
+    if (stats != nullptr)
+        stats->output += size;
+    std::uint32_t expected_adler32 = decoder.get4byte_bigendian ();
+    if (adler32->digest () != expected_adler32)
+        throw std::runtime_error ("cppgzip: mismatch Adler-32.");
+}
+
+void raw_decompress (std::istream& cin, std::ostream* cout,
+    stream_stats* stats)
+{
+    auto none = std::make_shared<digest_base> ();
+    lzss_compression lzss (none);
+    huffman_decoder decoder (cin, lzss);
+    decoder.set_stats (stats);
+    std::size_t const size
+        = cout != nullptr ? decoder.decode (*cout) : decoder.decode ();
+    if (stats != nullptr)
+        stats->output += size;
+}
+
+}// namespace deflate